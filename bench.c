@@ -0,0 +1,383 @@
+// Benchmarks for the arithmetic and mapping hot paths.
+//
+// Build and run:
+//   gcc -O2 -DMAPPER_NO_MAIN bench.c mapper.c large_int_arithmetic.c -o bench -lm -pthread
+//   ./bench [--quick] [--max-digits N] > bench.json
+//
+// Each benchmark is timed over a number of samples; every sample repeats the
+// operation enough times to take about BENCH_SAMPLE_NS. Results (median and p99
+// of the per-operation time, plus digits/s) are written to stdout as JSON so runs
+// can be compared between versions; a readable summary goes to stderr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "large_int_arithmetic.h"
+#include "mapper.h"
+
+#define BENCH_SAMPLE_NS 2000000.0
+#define BENCH_MAX_SAMPLES 31
+#define BENCH_BATCH_KEYS 200000
+#define BENCH_KEY_DIGITS 76
+#define SPIRAL_BENCH_DIVISOR 3080
+
+static volatile long long bench_sink; // Keeps results observable to the compiler
+
+struct bench_result {
+    const char* name;
+    int divisor; // 0 when not applicable
+    size_t digits;
+    int threads;
+    size_t ops_per_sample;
+    int samples;
+    double median_ns;
+    double p99_ns;
+};
+
+// Shared state for the benchmark bodies below.
+struct bench_input {
+    const char* number;
+    size_t len;
+    int divisor;
+    char* quotient;
+    size_t quotient_size;
+    const char* const* keys;
+    size_t key_count;
+    float* x;
+    float* y;
+    int* status;
+    int threads;
+};
+
+typedef void (*bench_fn)(const struct bench_input* in);
+
+static void bench_mod(const struct bench_input* in) {
+    bench_sink += calculate_large_mod(in->number, in->divisor);
+}
+
+static void bench_mod_parallel(const struct bench_input* in) {
+    bench_sink += calculate_large_mod_parallel_n(in->number, in->len, in->divisor, in->threads);
+}
+
+static void bench_div(const struct bench_input* in) {
+    bench_sink += calculate_large_div_to_string(in->number, in->divisor, in->quotient, in->quotient_size);
+}
+
+static void bench_map(const struct bench_input* in) {
+    float x, y;
+    bench_sink += map_to_cartesian(in->number, &x, &y);
+    bench_sink += (long long)x;
+}
+
+// A 360 x 180 spiral: generated tables and a divisor prepared at run time.
+static struct mapper_geometry bench_geometry;
+
+static void bench_map_geometry(const struct bench_input* in) {
+    float x, y;
+    bench_sink += map_to_cartesian_geometry(&bench_geometry, in->number, NULL, NULL, &x, &y);
+    bench_sink += (long long)x;
+}
+
+// Gross radius and its ring, the way run_example computed them from text: divide by
+// 40 into a decimal string, then parse that string again for the mod 77.
+static void bench_radius_string(const struct bench_input* in) {
+    bench_sink += calculate_large_div_to_string(in->number, 40, in->quotient, in->quotient_size);
+    bench_sink += calculate_large_mod(in->quotient, 77);
+}
+
+// The same with struct large_int: parse once, divide in place, reduce the limbs.
+static struct large_int bench_large_int = LARGE_INT_INIT;
+
+static void bench_radius_large_int(const struct bench_input* in) {
+    bench_sink += large_int_from_string_n(&bench_large_int, in->number, in->len);
+    bench_sink += calculate_large_div_int(&bench_large_int, 40, &bench_large_int);
+    bench_sink += calculate_large_mod_int(&bench_large_int, 77);
+}
+
+// Gross radius as a float the way run_example prints it: the full quotient string,
+// then strtof. Against it, the double from the leading digits.
+static void bench_gross_radius_string(const struct bench_input* in) {
+    bench_sink += calculate_large_div_to_string(in->number, 40, in->quotient, in->quotient_size);
+    bench_sink += (long long)strtof(in->quotient, NULL);
+}
+
+static void bench_gross_radius_double(const struct bench_input* in) {
+    double radius, log10_radius;
+    bench_sink += calculate_large_div_to_double_n(in->number, in->len, 40, &radius, &log10_radius);
+    bench_sink += (long long)log10_radius;
+}
+
+// Eight residues of the same number: one calculate_large_mod_n per divisor, or a
+// single calculate_large_mod_multi_n scan.
+static const int bench_multi_divisors[8] = { 40, 77, 97, 101, 211, 997, 1009, 65537 };
+
+static void bench_mod_separate(const struct bench_input* in) {
+    for (int d = 0; d < 8; ++d) bench_sink += calculate_large_mod_n(in->number, in->len, bench_multi_divisors[d]);
+}
+
+static void bench_mod_multi(const struct bench_input* in) {
+    int residues[8];
+    bench_sink += calculate_large_mod_multi_n(in->number, in->len, bench_multi_divisors, 8, residues);
+    bench_sink += residues[7];
+}
+
+#if defined(__SIZEOF_INT128__)
+// A 64-bit modulus (3080 x a prime) and a 125-bit one, against the plain widening of
+// the old loop: one 128-bit % per digit.
+#define BENCH_WIDE_DIVISOR (3080ULL * 1000000000000007ULL)
+
+static void bench_mod_u64(const struct bench_input* in) {
+    uint64_t remainder;
+    bench_sink += calculate_large_mod_u64_n(in->number, in->len, BENCH_WIDE_DIVISOR, &remainder);
+    bench_sink += (long long)remainder;
+}
+
+static void bench_mod_u64_per_digit(const struct bench_input* in) {
+    uint64_t remainder = 0;
+    for (size_t i = 0; i < in->len; ++i) {
+        remainder = (uint64_t)(((unsigned __int128)remainder * 10 + (uint64_t)(in->number[i] - '0')) % BENCH_WIDE_DIVISOR);
+    }
+    bench_sink += (long long)remainder;
+}
+
+static void bench_mod_u128(const struct bench_input* in) {
+    unsigned __int128 divisor = ((unsigned __int128)BENCH_WIDE_DIVISOR << 64 | 12345) >> 3;
+    unsigned __int128 remainder;
+    bench_sink += calculate_large_mod_u128_n(in->number, in->len, divisor, &remainder);
+    bench_sink += (long long)remainder;
+}
+#endif
+
+static void bench_map_hex(const struct bench_input* in) {
+    float x, y;
+    bench_sink += map_to_cartesian_hex(in->number, &x, &y);
+    bench_sink += (long long)x;
+}
+
+static void bench_map_bytes(const struct bench_input* in) {
+    float x, y;
+    bench_sink += map_to_cartesian_bytes((const unsigned char*)in->number, in->len, &x, &y);
+    bench_sink += (long long)x;
+}
+
+static void bench_batch(const struct bench_input* in) {
+    bench_sink += map_to_cartesian_batch(in->keys, in->key_count, in->x, in->y, in->status, in->threads);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+// Times fn, reporting per-operation nanoseconds (divided by ops_per_call for
+// batch bodies that perform several operations per call).
+static struct bench_result run_bench(const char* name, bench_fn fn, const struct bench_input* in,
+                                     size_t digits, size_t ops_per_call, int samples) {
+    struct bench_result result = { name, in->divisor, digits, in->threads, 0, samples, 0.0, 0.0 };
+
+    // Calibrate: double the repetitions until one sample takes long enough.
+    size_t reps = 1;
+    for (;;) {
+        double start = now_ns();
+        for (size_t r = 0; r < reps; ++r) fn(in);
+        double elapsed = now_ns() - start;
+        if (elapsed >= BENCH_SAMPLE_NS || reps >= ((size_t)1 << 30)) break;
+        reps *= 2;
+    }
+
+    double per_op[BENCH_MAX_SAMPLES];
+    for (int s = 0; s < samples; ++s) {
+        double start = now_ns();
+        for (size_t r = 0; r < reps; ++r) fn(in);
+        per_op[s] = (now_ns() - start) / (double)(reps * ops_per_call);
+    }
+    qsort(per_op, (size_t)samples, sizeof(per_op[0]), compare_doubles);
+
+    size_t p99_index = (size_t)(0.99 * (samples - 1) + 0.5);
+    result.ops_per_sample = reps * ops_per_call;
+    result.median_ns = per_op[samples / 2];
+    result.p99_ns = per_op[p99_index];
+    return result;
+}
+
+// Deterministic pseudo-random digits with a non-zero leading digit.
+static void fill_digits(char* out, size_t len, unsigned long long* seed) {
+    for (size_t i = 0; i < len; ++i) {
+        *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        out[i] = (char)('0' + (*seed >> 60) % 10);
+    }
+    if (len > 1 && out[0] == '0') out[0] = '1';
+    out[len] = '\0';
+}
+
+static void print_result(const struct bench_result* r, int first) {
+    double digits_per_sec = r->median_ns > 0.0 ? (double)r->digits * 1e9 / r->median_ns : 0.0;
+    printf("%s    {\"name\": \"%s\", \"divisor\": %d, \"digits\": %zu, \"threads\": %d, "
+           "\"samples\": %d, \"ops_per_sample\": %zu, \"median_ns\": %.2f, \"p99_ns\": %.2f, "
+           "\"digits_per_sec\": %.0f}",
+           first ? "" : ",\n", r->name, r->divisor, r->digits, r->threads,
+           r->samples, r->ops_per_sample, r->median_ns, r->p99_ns, digits_per_sec);
+    fprintf(stderr, "%-30s d=%-10d digits=%-8zu threads=%-3d median %12.1f ns  p99 %12.1f ns  %10.3e digits/s\n",
+            r->name, r->divisor, r->digits, r->threads, r->median_ns, r->p99_ns, digits_per_sec);
+}
+
+int main(int argc, char** argv) {
+    size_t max_digits = 1000000;
+    int samples = BENCH_MAX_SAMPLES;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            max_digits = 10000;
+            samples = 11;
+        } else if (strcmp(argv[i], "--max-digits") == 0 && i + 1 < argc) {
+            max_digits = (size_t)strtoull(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [--quick] [--max-digits N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const size_t lengths[] = {1, 10, 19, 76, 100, 1000, 10000, 100000, 1000000};
+    const int divisors[] = {40, 77, 3080, 1000000007, 2147483647};
+    unsigned long long seed = 0x2545F4914F6CDD1DULL;
+
+    char* number = malloc(max_digits + 1);
+    char* quotient = malloc(max_digits + 2);
+    if (!number || !quotient) {
+        fprintf(stderr, "Error: cannot allocate %zu-digit buffers\n", max_digits);
+        return 1;
+    }
+
+    if (mapper_geometry_init(&bench_geometry, 360, 180, 1.0f) == -1) {
+        fprintf(stderr, "Error: cannot set up the 360 x 180 geometry\n");
+        return 1;
+    }
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_counts[] = {1, online > 1 ? (int)online : 1};
+    int thread_runs = thread_counts[1] > 1 ? 2 : 1;
+
+    printf("{\n  \"benchmarks\": [\n");
+    int first = 1;
+
+    // Single-call latency over input length and divisor
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+        size_t len = lengths[l];
+        if (len > max_digits) break;
+        fill_digits(number, len, &seed);
+
+        struct bench_input in = { number, len, 0, quotient, max_digits + 2, NULL, 0, NULL, NULL, NULL, 1 };
+        for (size_t d = 0; d < sizeof(divisors) / sizeof(divisors[0]); ++d) {
+            in.divisor = divisors[d];
+            struct bench_result r = run_bench("calculate_large_mod", bench_mod, &in, len, 1, samples);
+            print_result(&r, first);
+            first = 0;
+            r = run_bench("calculate_large_div_to_string", bench_div, &in, len, 1, samples);
+            print_result(&r, first);
+        }
+        in.divisor = 0;
+        struct bench_result r = run_bench("map_to_cartesian", bench_map, &in, len, 1, samples);
+        print_result(&r, first);
+        in.divisor = bench_geometry.cell_count;
+        r = run_bench("map_to_cartesian_geometry", bench_map_geometry, &in, len, 1, samples);
+        print_result(&r, first);
+        in.divisor = 40;
+        r = run_bench("gross_radius_string", bench_gross_radius_string, &in, len, 1, samples);
+        print_result(&r, first);
+        r = run_bench("gross_radius_double", bench_gross_radius_double, &in, len, 1, samples);
+        print_result(&r, first);
+        in.divisor = 0;
+        r = run_bench("mod_8_divisors_separate", bench_mod_separate, &in, len, 1, samples);
+        print_result(&r, first);
+        r = run_bench("mod_8_divisors_multi", bench_mod_multi, &in, len, 1, samples);
+        print_result(&r, first);
+#if defined(__SIZEOF_INT128__)
+        r = run_bench("calculate_large_mod_u64", bench_mod_u64, &in, len, 1, samples);
+        print_result(&r, first);
+        r = run_bench("calculate_large_mod_u128", bench_mod_u128, &in, len, 1, samples);
+        print_result(&r, first);
+        if (len <= 10000) {
+            r = run_bench("mod_u64_per_digit", bench_mod_u64_per_digit, &in, len, 1, samples);
+            print_result(&r, first);
+        }
+#endif
+        in.divisor = 0;
+        if (len <= 10000) {
+            r = run_bench("radius_pipeline_string", bench_radius_string, &in, len, 1, samples);
+            print_result(&r, first);
+            r = run_bench("radius_pipeline_large_int", bench_radius_large_int, &in, len, 1, samples);
+            print_result(&r, first);
+        }
+
+        // Inputs long enough for calculate_large_mod_parallel to split them
+        if (len >= 1000000) {
+            in.divisor = SPIRAL_BENCH_DIVISOR;
+            for (int t = 0; t < thread_runs; ++t) {
+                in.threads = thread_counts[t];
+                r = run_bench("calculate_large_mod_parallel", bench_mod_parallel, &in, len, 1, samples);
+                print_result(&r, first);
+            }
+            in.threads = 1;
+        }
+    }
+
+    // Batch throughput on BENCH_KEY_DIGITS-digit keys, single thread and all CPUs
+    char* key_storage = malloc((size_t)BENCH_BATCH_KEYS * (BENCH_KEY_DIGITS + 1));
+    const char** keys = malloc(BENCH_BATCH_KEYS * sizeof(*keys));
+    float* x = malloc(BENCH_BATCH_KEYS * sizeof(*x));
+    float* y = malloc(BENCH_BATCH_KEYS * sizeof(*y));
+    int* status = malloc(BENCH_BATCH_KEYS * sizeof(*status));
+    if (!key_storage || !keys || !x || !y || !status) {
+        fprintf(stderr, "Error: cannot allocate batch buffers\n");
+        return 1;
+    }
+    for (size_t i = 0; i < BENCH_BATCH_KEYS; ++i) {
+        keys[i] = key_storage + i * (BENCH_KEY_DIGITS + 1);
+        fill_digits((char*)keys[i], BENCH_KEY_DIGITS, &seed);
+    }
+
+    for (int t = 0; t < thread_runs; ++t) {
+        struct bench_input in = { NULL, 0, 0, NULL, 0, keys, BENCH_BATCH_KEYS, x, y, status, thread_counts[t] };
+        struct bench_result r = run_bench("map_to_cartesian_batch", bench_batch, &in,
+                                          BENCH_KEY_DIGITS, BENCH_BATCH_KEYS, samples < 11 ? samples : 11);
+        print_result(&r, first);
+    }
+
+    // The same 256-bit key as 64 hex digits and as 32 raw bytes (digits = input bytes)
+    char hex_key[65];
+    unsigned char byte_key[32];
+    for (int i = 0; i < 32; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        byte_key[i] = (unsigned char)(seed >> 56);
+        snprintf(hex_key + 2 * i, 3, "%02x", byte_key[i]);
+    }
+    struct bench_input hex_in = { hex_key, 64, 0, NULL, 0, NULL, 0, NULL, NULL, NULL, 1 };
+    struct bench_result r = run_bench("map_to_cartesian_hex", bench_map_hex, &hex_in, 64, 1, samples);
+    print_result(&r, first);
+    struct bench_input bytes_in = { (const char*)byte_key, 32, 0, NULL, 0, NULL, 0, NULL, NULL, NULL, 1 };
+    r = run_bench("map_to_cartesian_bytes", bench_map_bytes, &bytes_in, 32, 1, samples);
+    print_result(&r, first);
+
+    printf("\n  ]\n}\n");
+
+    free(key_storage);
+    free(keys);
+    free(x);
+    free(y);
+    free(status);
+    free(number);
+    free(quotient);
+    large_int_free(&bench_large_int);
+    mapper_geometry_free(&bench_geometry);
+    return 0;
+}
@@ -2,6 +2,7 @@
 #define LARGE_INT_ARITHMETIC_H
 
 #include <stddef.h> // For size_t
+#include <stdint.h> // For uint64_t
 
 // Calculates (large_num_str % divisor)
 // Returns the integer remainder.
@@ -24,4 +25,264 @@ int calculate_large_div_to_string(
     size_t quotient_buffer_size
 );
 
+// Length-based variants of the two functions above. They read exactly len bytes
+// from digits, which need not be NUL-terminated (e.g. a line inside a larger
+// buffer or a memory-mapped file), and fail with -1 in the same cases, with
+// len == 0 taking the place of the empty string.
+int calculate_large_mod_n(const char* digits, size_t len, int divisor);
+
+int calculate_large_div_to_string_n(
+    const char* digits,
+    size_t len,
+    int divisor,
+    char* quotient_str_out,
+    size_t quotient_buffer_size
+);
+
+// Calculates floor(large_num_str / divisor) rounded to the nearest double into
+// *quotient_out (HUGE_VAL if it exceeds DBL_MAX), and its base-10 logarithm into
+// *log10_out unless that is NULL (-HUGE_VAL for a zero quotient; finite for any
+// non-zero quotient, however large). Only the leading 38 digits are divided and the
+// rest of the number is just counted, except in the rare case where that cannot
+// settle the rounding; then the whole quotient is computed. The _n variant reads
+// exactly len bytes.
+// Returns 0 on success.
+// Returns -1 if large_num_str or quotient_out is NULL, if large_num_str is empty or
+// contains non-digits, if divisor is <= 0, or on allocation failure.
+int calculate_large_div_to_double(const char* large_num_str, int divisor, double* quotient_out, double* log10_out);
+
+int calculate_large_div_to_double_n(const char* digits, size_t len, int divisor, double* quotient_out,
+                                    double* log10_out);
+
+// calculate_large_div_to_double_n without allocating: the exact quotient, when it
+// is needed (always, without a 128-bit integer type), is written to scratch. If
+// scratch is NULL or holds fewer than len + 1 bytes (len without leading zeros) at
+// that point, nothing is written to the outputs and LARGE_DIV_DOUBLE_NEEDS_SCRATCH
+// is returned; passing len + 1 bytes always succeeds. Otherwise returns as
+// calculate_large_div_to_double_n.
+#define LARGE_DIV_DOUBLE_NEEDS_SCRATCH (-2)
+
+int calculate_large_div_to_double_scratch_n(const char* digits, size_t len, int divisor, double* quotient_out,
+                                            double* log10_out, char* scratch, size_t scratch_size);
+
+// Incremental reduction, for numbers that arrive in pieces (read from a socket or
+// a file in fixed-size blocks, say). The state is a fixed-size struct owned by the
+// caller, so memory use does not depend on the length of the number. Its fields
+// are internal to large_int_arithmetic.c.
+struct large_divisor {
+    uint64_t d_norm;
+    uint64_t v;
+    int shift;
+};
+
+struct large_reducer {
+    struct large_divisor pre;
+    uint64_t remainder;
+    char* quotient_out; // NULL when only the remainder is wanted
+    size_t quotient_buffer_size;
+    size_t quotient_len;
+    uint64_t digit_count;
+    int has_started_quotient; // To handle leading zeros in quotient
+    int overflow; // Quotient did not fit in quotient_buffer_size
+    int invalid;  // A non-digit was fed, or init failed
+};
+
+// A divisor prepared for reduction. Every reduction needs a reciprocal of its
+// divisor; large_divisor_init computes it once so that many numbers can then be
+// reduced by calculate_large_mod_prepared_n without recomputing it, and
+// LARGE_DIVISOR_INIT(divisor) is a constant initializer for the same value when
+// the divisor is a compile-time constant, so the compiler folds the reciprocal.
+// Returns 0, or -1 if pre is NULL or divisor is <= 0.
+int large_divisor_init(struct large_divisor* pre, int divisor);
+
+#if defined(__SIZEOF_INT128__)
+#define LARGE_DIVISOR_NORM_(divisor) ((uint64_t)(divisor) << __builtin_clzll((uint64_t)(divisor)))
+#define LARGE_DIVISOR_INIT(divisor)                                                                   \
+    { LARGE_DIVISOR_NORM_(divisor),                                                                   \
+      (uint64_t)((((unsigned __int128)~LARGE_DIVISOR_NORM_(divisor)) << 64 | ~(uint64_t)0) /          \
+                 LARGE_DIVISOR_NORM_(divisor)),                                                        \
+      __builtin_clzll((uint64_t)(divisor)) }
+#else
+#define LARGE_DIVISOR_INIT(divisor) { (uint64_t)(divisor), 0, 0 }
+#endif
+
+// calculate_large_mod_n by a prepared divisor. Returns the remainder, or -1 if
+// pre or digits is NULL, pre was never initialized, len is 0 or a non-digit is found.
+int calculate_large_mod_prepared_n(const struct large_divisor* pre, const char* digits, size_t len);
+
+// Divisors wider than an int. The remainder can exceed INT_MAX, so it is returned
+// through remainder_out (which the div variants also accept as NULL). 64-bit
+// divisors are reduced exactly like int ones, 16 to 32 digits per step with the
+// preinverted divisor; without 128-bit integers they must be below 2^32.
+// Returns 0, or -1 if a required pointer is NULL, divisor is 0 (or too large),
+// the number is empty or contains non-digits, or quotient_buffer_size is too small
+// for the quotient and its terminator.
+int calculate_large_mod_u64(const char* large_num_str, uint64_t divisor, uint64_t* remainder_out);
+
+int calculate_large_mod_u64_n(const char* digits, size_t len, uint64_t divisor, uint64_t* remainder_out);
+
+int calculate_large_div_to_string_u64_n(const char* digits, size_t len, uint64_t divisor, char* quotient_str_out,
+                                        size_t quotient_buffer_size, uint64_t* remainder_out);
+
+#if defined(__SIZEOF_INT128__)
+// The same for divisors of up to 128 bits, where the compiler has a 128-bit type.
+// Divisors of 2^64 or more are reduced 19 digits per step, each step a 3-by-2 limb
+// division by the preinverted divisor; smaller ones take the 64-bit path.
+int calculate_large_mod_u128(const char* large_num_str, unsigned __int128 divisor, unsigned __int128* remainder_out);
+
+int calculate_large_mod_u128_n(const char* digits, size_t len, unsigned __int128 divisor,
+                               unsigned __int128* remainder_out);
+
+int calculate_large_div_to_string_u128_n(const char* digits, size_t len, unsigned __int128 divisor,
+                                         char* quotient_str_out, size_t quotient_buffer_size,
+                                         unsigned __int128* remainder_out);
+#endif
+
+// Reduces one decimal number modulo k divisors in a single scan: residues_out[i]
+// is set to N % divisors[i]. Consecutive divisors whose product fits in 63 bits
+// (32 without 128-bit integers) share one running remainder, e.g. 40 and 77 are
+// reduced together as 3080, and up to LARGE_MOD_MULTI_GROUPS such remainders are
+// updated side by side from each parsed chunk, so k residues cost about one pass
+// instead of k. Divisors that need more groups take one more pass each
+// LARGE_MOD_MULTI_GROUPS groups.
+// Returns 0, or -1 (residues_out untouched) if a pointer is NULL, k is 0, a divisor
+// is <= 0, or the number is empty or contains a non-digit.
+#define LARGE_MOD_MULTI_GROUPS 8
+
+int calculate_large_mod_multi(const char* large_num_str, const int* divisors, size_t k, int* residues_out);
+
+int calculate_large_mod_multi_n(const char* digits, size_t len, const int* divisors, size_t k, int* residues_out);
+
+// Starts a reduction of a number by divisor. If quotient_out is not NULL the
+// quotient digits are written to it as they are produced (without leading zeros),
+// and quotient_buffer_size must leave room for the whole quotient plus terminator.
+// Returns 0, or -1 if red is NULL, divisor is <= 0 or quotient_buffer_size < 2
+// (finish then fails as well).
+int large_reducer_init(struct large_reducer* red, int divisor, char* quotient_out, size_t quotient_buffer_size);
+
+// Appends the next len digits of the number. Pieces may split the number anywhere.
+// Returns 0, or -1 if a piece contains a non-digit; the reduction then stays failed.
+int large_reducer_feed(struct large_reducer* red, const char* digits, size_t len);
+
+// Ends the reduction and NUL-terminates the quotient, if one was requested.
+// Returns the remainder, or -1 if no digits were fed, a non-digit was fed, or the
+// quotient did not fit (quotient_out is then the empty string).
+int large_reducer_finish(struct large_reducer* red);
+
+// Same as calculate_large_mod / calculate_large_mod_n, with the digits split into
+// contiguous pieces reduced by num_threads threads (<= 0 uses one per online CPU)
+// and combined with powers of 10 modulo divisor. Inputs too short to be worth
+// splitting (under about 256K digits per thread) are reduced on the calling thread.
+int calculate_large_mod_parallel(const char* large_num_str, int divisor, int num_threads);
+
+// Pieces are at least this many digits, so shorter inputs always take the serial path.
+#define LARGE_MOD_PARALLEL_MIN_DIGITS (1 << 18)
+
+int calculate_large_mod_parallel_n(const char* digits, size_t len, int divisor, int num_threads);
+
+// Calculates (value % divisor) for a big-endian unsigned binary number of len bytes.
+// Returns the integer remainder, or -1 if bytes is NULL, len is 0 or divisor is <= 0.
+int calculate_large_mod_bytes(const unsigned char* bytes, size_t len, int divisor);
+
+// Calculates (value % divisor) for a hexadecimal number string, with an optional
+// "0x"/"0X" prefix and digits in either case. The _n variant reads exactly len
+// bytes. Returns the integer remainder, or -1 if hex_str is NULL, has no digits,
+// contains a non-hex character, or if divisor is <= 0.
+int calculate_large_mod_hex(const char* hex_str, int divisor);
+
+int calculate_large_mod_hex_n(const char* hex, size_t len, int divisor);
+
+// Calculates (large_num_str + addend) and stores the result in sum_str_out,
+// without leading zeros.
+// Returns 0 on success.
+// Returns -1 if any pointer is NULL, if large_num_str is empty or contains non-digits,
+// or if sum_buffer_size is too small for the result including null terminator
+// (strlen(large_num_str) + 22 is always enough).
+int calculate_large_add_to_string(
+    const char* large_num_str,
+    unsigned long long addend,
+    char* sum_str_out,
+    size_t sum_buffer_size
+);
+
+// Calculates (b_str - a_str) into *difference_out.
+// Returns 0 on success.
+// Returns -1 if any pointer is NULL, if either string is empty or contains non-digits,
+// if b_str < a_str, or if the difference does not fit in an unsigned long long.
+int calculate_large_difference(const char* a_str, const char* b_str, unsigned long long* difference_out);
+
+// Calculates (b_str - a_str) for any sizes and stores it in difference_str_out,
+// without leading zeros. Works digit by digit, in time linear in the length of b_str.
+// Returns 0 on success.
+// Returns -1 if any pointer is NULL, if either string is empty or contains non-digits,
+// if b_str < a_str, or if difference_buffer_size is smaller than the significant
+// digits of b_str plus the null terminator (strlen(b_str) + 1 is always enough).
+int calculate_large_difference_to_string(
+    const char* a_str,
+    const char* b_str,
+    char* difference_str_out,
+    size_t difference_buffer_size
+);
+
+// Calculates (large_num_str * multiplier + addend) and stores the result in
+// result_str_out, without leading zeros, in one pass over the digits.
+// Returns 0 on success.
+// Returns -1 if any pointer is NULL, if large_num_str is empty or contains non-digits,
+// or if result_buffer_size is too small for the result including null terminator
+// (strlen(large_num_str) + 12 is always enough).
+int calculate_large_mul_add_to_string(
+    const char* large_num_str,
+    unsigned int multiplier,
+    unsigned int addend,
+    char* result_str_out,
+    size_t result_buffer_size
+);
+
+// Parsed unsigned big integer, for pipelines that run several operations on the
+// same number: parse it once, then divide, add and compare without re-reading
+// text, and format it only when the decimal string is needed. The value is held
+// as little-endian uint64 limbs with no zero limbs at the top (count == 0 is zero).
+// Start with large_int_init (or LARGE_INT_INIT) and release with large_int_free.
+// Functions that write a large_int grow its limbs as needed and return -1 if that
+// allocation fails.
+struct large_int {
+    uint64_t* limbs;
+    size_t count;
+    size_t capacity;
+};
+
+#define LARGE_INT_INIT { NULL, 0, 0 }
+
+void large_int_init(struct large_int* n);
+void large_int_free(struct large_int* n);
+
+// Parses a decimal number string (leading zeros allowed) into n. The _n variant
+// reads exactly len bytes. Returns 0, or -1 if the string is NULL, empty or
+// contains non-digits (n is then zero).
+int large_int_from_string(struct large_int* n, const char* large_num_str);
+int large_int_from_string_n(struct large_int* n, const char* digits, size_t len);
+
+// Loads a big-endian unsigned binary number of len bytes into n.
+// Returns 0, or -1 if bytes is NULL or len is 0.
+int large_int_from_bytes(struct large_int* n, const unsigned char* bytes, size_t len);
+
+// Writes n as a decimal string without leading zeros ("0" for zero).
+// Returns 0, or -1 if a pointer is NULL or buffer_size is too small for the result
+// including null terminator (large_int_string_size(n) is always enough).
+int large_int_to_string(const struct large_int* n, char* str_out, size_t buffer_size);
+size_t large_int_string_size(const struct large_int* n);
+
+// sum_out = a + b. sum_out may be a or b. Returns 0 or -1.
+int large_int_add(struct large_int* sum_out, const struct large_int* a, const struct large_int* b);
+
+// Returns -1, 0 or 1 as a is less than, equal to or greater than b.
+int large_int_compare(const struct large_int* a, const struct large_int* b);
+
+// calculate_large_mod and calculate_large_div_to_string for a parsed number.
+// calculate_large_div_int divides by a single word: it stores n / divisor in
+// quotient_out (which may be n itself, or NULL to skip it) and returns n % divisor.
+// Both return -1 if n is NULL or divisor is <= 0.
+int calculate_large_mod_int(const struct large_int* n, int divisor);
+int calculate_large_div_int(const struct large_int* n, int divisor, struct large_int* quotient_out);
+
 #endif // LARGE_INT_ARITHMETIC_H
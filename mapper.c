@@ -3,272 +3,5029 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#if defined(MAPPER_STATS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h> // For __rdtsc
+#endif
 
-// Function prototypes for large integer arithmetic (from large_int_arithmetic.h)
-int calculate_large_mod(const char* large_num_str, int divisor);
-int calculate_large_div_to_string(
-    const char* large_num_str,
-    int divisor,
-    char* quotient_str_out,
-    size_t quotient_buffer_size
-);
-
-// Helper function (from large_int_arithmetic.c)
-// NOTE: This was static in large_int_arithmetic.c.
-// It can remain static if only used by the arithmetic functions within this consolidated file.
-// If map_to_cartesian or main also needed it directly (they don't seem to), it would need to be non-static.
-// For now, keeping it static as its usage is localized to the arithmetic functions.
-static int is_valid_number_string(const char* s) {
-    if (!s || *s == '\0') return 0; // NULL or empty
-    // Check if it's "0"
-    if (s[0] == '0' && s[1] == '\0') return 1;
-    // Check for leading zeros if not "0"
-    // This check was originally in the helper but calculate_large_mod/div do their own full digit checks.
-    // For strict equivalence to the original, it's included.
-    // However, the actual arithmetic functions below iterate and check all digits,
-    // and handle "0" or numbers with leading zeros before this helper would be strictly necessary
-    // for their internal logic if they called it.
-    // The primary validation is done by direct iteration and isdigit checks in the arithmetic functions.
-    // This helper isn't directly called by the provided arithmetic functions, so it's effectively unused as is.
-    // To simplify and match the provided arithmetic code (which doesn't call this helper),
-    // this helper could be omitted if not used. For now, keeping it as it was in the source file.
-    if (s[0] == '0' && strlen(s) > 1) return 0;
-
-    for (size_t i = 0; s[i] != '\0'; ++i) {
-        if (!isdigit(s[i])) return 0; // Not a digit
-    }
-    return 1;
+#include "large_int_arithmetic.h"
+#include "mapper.h"
+
+// Spiral geometry: 40 angular vectors (9 degrees apart) wrapped over 77 rings.
+// The mapped point depends only on N mod (40 * 77), see map_to_cartesian.
+#define SPIRAL_ANGULAR_DIVISIONS 40
+#define SPIRAL_RING_COUNT 77
+#define SPIRAL_PERIOD (SPIRAL_ANGULAR_DIVISIONS * SPIRAL_RING_COUNT)
+
+// MAPPER_CELL_COUNT in mapper.h must agree.
+typedef char spiral_period_matches_cell_count[SPIRAL_PERIOD == MAPPER_CELL_COUNT ? 1 : -1];
+
+// Pre-calculated cosine and sine values for each angular vector, as (cos, sin) pairs.
+// Kept as an X-macro so sin_table/cos_table and the coordinate table below are
+// built from the very same literals.
+#define SPIRAL_TRIG_VALUES(X, arg) \
+    X(arg,  1.00000000,  0.00000000) \
+    X(arg,  0.98768834,  0.15643447) \
+    X(arg,  0.95105652,  0.30901699) \
+    X(arg,  0.89100651,  0.45399050) \
+    X(arg,  0.80901699,  0.58778525) \
+    X(arg,  0.70710677,  0.70710677) \
+    X(arg,  0.58778525,  0.80901699) \
+    X(arg,  0.45399050,  0.89100651) \
+    X(arg,  0.30901699,  0.95105652) \
+    X(arg,  0.15643447,  0.98768834) \
+    X(arg,  0.00000000,  1.00000000) \
+    X(arg, -0.15643447,  0.98768834) \
+    X(arg, -0.30901699,  0.95105652) \
+    X(arg, -0.45399050,  0.89100651) \
+    X(arg, -0.58778525,  0.80901699) \
+    X(arg, -0.70710677,  0.70710677) \
+    X(arg, -0.80901699,  0.58778525) \
+    X(arg, -0.89100651,  0.45399050) \
+    X(arg, -0.95105652,  0.30901699) \
+    X(arg, -0.98768834,  0.15643447) \
+    X(arg, -1.00000000,  0.00000000) \
+    X(arg, -0.98768834, -0.15643445) \
+    X(arg, -0.95105652, -0.30901702) \
+    X(arg, -0.89100651, -0.45399053) \
+    X(arg, -0.80901699, -0.58778528) \
+    X(arg, -0.70710677, -0.70710683) \
+    X(arg, -0.58778525, -0.80901702) \
+    X(arg, -0.45399050, -0.89100657) \
+    X(arg, -0.30901699, -0.95105658) \
+    X(arg, -0.15643447, -0.98768837) \
+    X(arg,  0.00000000, -1.00000000) \
+    X(arg,  0.15643447, -0.98768837) \
+    X(arg,  0.30901699, -0.95105658) \
+    X(arg,  0.45399050, -0.89100657) \
+    X(arg,  0.58778525, -0.80901702) \
+    X(arg,  0.70710677, -0.70710683) \
+    X(arg,  0.80901699, -0.58778528) \
+    X(arg,  0.89100651, -0.45399053) \
+    X(arg,  0.95105652, -0.30901702) \
+    X(arg,  0.98768834, -0.15643445)
+
+#define TRIG_SIN_VALUE(arg, cos_val, sin_val) sin_val,
+#define TRIG_COS_VALUE(arg, cos_val, sin_val) cos_val,
+
+// Pre-calculated sine and cosine tables (from mapper.c)
+const float sin_table[40] = { SPIRAL_TRIG_VALUES(TRIG_SIN_VALUE, 0) };
+const float cos_table[40] = { SPIRAL_TRIG_VALUES(TRIG_COS_VALUE, 0) };
+
+// (R_efetivo * cos, R_efetivo * sin) for every residue N mod SPIRAL_PERIOD.
+// Residue r sits on theta_index = r % 40 and indice_circunferencia = r / 40,
+// so the table is laid out ring by ring, 40 angles per ring. The products are
+// float constant expressions, rounded exactly as the runtime float multiply.
+#define SPIRAL_POINT(R_efetivo, cos_val, sin_val) \
+    { (float)(R_efetivo) * (float)(cos_val), (float)(R_efetivo) * (float)(sin_val) },
+#define SPIRAL_RING(indice_circunferencia) \
+    SPIRAL_TRIG_VALUES(SPIRAL_POINT, (indice_circunferencia) + 1.0f)
+
+static const struct mapper_point spiral_point_table[SPIRAL_PERIOD] = {
+    SPIRAL_RING( 0) SPIRAL_RING( 1) SPIRAL_RING( 2) SPIRAL_RING( 3) SPIRAL_RING( 4) SPIRAL_RING( 5) SPIRAL_RING( 6)
+    SPIRAL_RING( 7) SPIRAL_RING( 8) SPIRAL_RING( 9) SPIRAL_RING(10) SPIRAL_RING(11) SPIRAL_RING(12) SPIRAL_RING(13)
+    SPIRAL_RING(14) SPIRAL_RING(15) SPIRAL_RING(16) SPIRAL_RING(17) SPIRAL_RING(18) SPIRAL_RING(19) SPIRAL_RING(20)
+    SPIRAL_RING(21) SPIRAL_RING(22) SPIRAL_RING(23) SPIRAL_RING(24) SPIRAL_RING(25) SPIRAL_RING(26) SPIRAL_RING(27)
+    SPIRAL_RING(28) SPIRAL_RING(29) SPIRAL_RING(30) SPIRAL_RING(31) SPIRAL_RING(32) SPIRAL_RING(33) SPIRAL_RING(34)
+    SPIRAL_RING(35) SPIRAL_RING(36) SPIRAL_RING(37) SPIRAL_RING(38) SPIRAL_RING(39) SPIRAL_RING(40) SPIRAL_RING(41)
+    SPIRAL_RING(42) SPIRAL_RING(43) SPIRAL_RING(44) SPIRAL_RING(45) SPIRAL_RING(46) SPIRAL_RING(47) SPIRAL_RING(48)
+    SPIRAL_RING(49) SPIRAL_RING(50) SPIRAL_RING(51) SPIRAL_RING(52) SPIRAL_RING(53) SPIRAL_RING(54) SPIRAL_RING(55)
+    SPIRAL_RING(56) SPIRAL_RING(57) SPIRAL_RING(58) SPIRAL_RING(59) SPIRAL_RING(60) SPIRAL_RING(61) SPIRAL_RING(62)
+    SPIRAL_RING(63) SPIRAL_RING(64) SPIRAL_RING(65) SPIRAL_RING(66) SPIRAL_RING(67) SPIRAL_RING(68) SPIRAL_RING(69)
+    SPIRAL_RING(70) SPIRAL_RING(71) SPIRAL_RING(72) SPIRAL_RING(73) SPIRAL_RING(74) SPIRAL_RING(75) SPIRAL_RING(76)
+};
+
+// SPIRAL_PERIOD prepared at compile time, so no reduction computes its reciprocal.
+static const struct large_divisor spiral_divisor = LARGE_DIVISOR_INIT(SPIRAL_PERIOD);
+
+// Validates number_str and reduces it modulo SPIRAL_PERIOD in a single pass.
+// Returns the residue (0..SPIRAL_PERIOD-1), or -1 if number_str is empty or
+// contains non-digits. calculate_large_mod validates and parses 16-32 digits per
+// step, so this is the only time the input is read.
+static int spiral_residue(const char* number_str) {
+    if (!number_str) return -1;
+    return calculate_large_mod_prepared_n(&spiral_divisor, number_str, strlen(number_str));
 }
 
-// Function implementation for calculate_large_mod (from large_int_arithmetic.c)
-int calculate_large_mod(const char* large_num_str, int divisor) {
-    if (!large_num_str) return -1;
-    size_t len = strlen(large_num_str);
-    if (len == 0) return -1;
+// Length-based variant of spiral_residue for numbers that are not NUL-terminated.
+static int spiral_residue_n(const char* digits, size_t len) {
+    return calculate_large_mod_prepared_n(&spiral_divisor, digits, len);
+}
 
-    for (size_t i = 0; i < len; ++i) {
-        if (!isdigit(large_num_str[i])) return -1;
-    }
+// spiral_residue for a single number that may be millions of digits long: the
+// digits are split across one thread per online CPU. Numbers too short to split
+// take the serial path, so the cost over spiral_residue is one length check.
+static int spiral_residue_parallel_n(const char* digits, size_t len) {
+    if (len < 2 * LARGE_MOD_PARALLEL_MIN_DIGITS) return spiral_residue_n(digits, len);
+    return calculate_large_mod_parallel_n(digits, len, SPIRAL_PERIOD, 0);
+}
 
-    if (divisor <= 0) return -1;
+// The built-in geometry, as mapper_geometry_init(40, 77, 1.0f) returns it.
+#define GEOMETRY_ANGLE_SHIFT 40
+static const struct mapper_geometry spiral_geometry = {
+    SPIRAL_ANGULAR_DIVISIONS, SPIRAL_RING_COUNT, 1.0f, SPIRAL_PERIOD, spiral_point_table,
+    LARGE_DIVISOR_INIT(SPIRAL_PERIOD), (1ULL << GEOMETRY_ANGLE_SHIFT) / SPIRAL_ANGULAR_DIVISIONS + 1, NULL
+};
 
-    long long remainder = 0;
+int mapper_geometry_init(struct mapper_geometry* geometry, int angular_divisions, int ring_count,
+                         float radius_offset) {
+    if (!geometry || angular_divisions < 1 || ring_count < 1) return -1;
+    if (ring_count > MAPPER_GEOMETRY_MAX_CELLS / angular_divisions) return -1;
+    if (!(fabsf(radius_offset) <= MAPPER_GEOMETRY_MAX_CELLS)) return -1; // Also rejects NaN
+    if (angular_divisions == SPIRAL_ANGULAR_DIVISIONS && ring_count == SPIRAL_RING_COUNT && radius_offset == 1.0f) {
+        *geometry = spiral_geometry;
+        return 0;
+    }
 
-    for (size_t i = 0; i < len; ++i) {
-        int digit_val = large_num_str[i] - '0';
-        remainder = (remainder * 10 + digit_val) % divisor;
+    int cell_count = angular_divisions * ring_count;
+    struct mapper_point* points = malloc((size_t)cell_count * sizeof(*points));
+    if (!points) return -1;
+    for (int theta = 0; theta < angular_divisions; ++theta) {
+        // cos and sin are not exactly 0 at multiples of 90 degrees; round those
+        // to 0 as the built-in table has them.
+        double angle = 2.0 * 3.14159265358979323846 * theta / angular_divisions;
+        double c = cos(angle), sn = sin(angle);
+        float cos_val = fabs(c) < 1e-12 ? 0.0f : (float)c;
+        float sin_val = fabs(sn) < 1e-12 ? 0.0f : (float)sn;
+        for (int ring = 0; ring < ring_count; ++ring) {
+            float R_efetivo = (float)ring + radius_offset;
+            points[theta + angular_divisions * ring].x = R_efetivo * cos_val;
+            points[theta + angular_divisions * ring].y = R_efetivo * sin_val;
+        }
     }
-    return (int)remainder;
+
+    geometry->angular_divisions = angular_divisions;
+    geometry->ring_count = ring_count;
+    geometry->radius_offset = radius_offset;
+    geometry->cell_count = cell_count;
+    geometry->points = points;
+    large_divisor_init(&geometry->cell_divisor, cell_count);
+    geometry->angle_reciprocal = (1ULL << GEOMETRY_ANGLE_SHIFT) / (unsigned long long)angular_divisions + 1;
+    geometry->owned_points = points;
+    return 0;
 }
 
-// Function implementation for calculate_large_div_to_string (from large_int_arithmetic.c)
-int calculate_large_div_to_string(
-    const char* large_num_str,
-    int divisor,
-    char* quotient_str_out,
-    size_t quotient_buffer_size
-) {
-    if (!quotient_str_out) return -1;
-    if (quotient_buffer_size == 0) {
-        if (quotient_str_out) *quotient_str_out = '\0';
-        return -1;
+void mapper_geometry_free(struct mapper_geometry* geometry) {
+    if (!geometry) return;
+    free(geometry->owned_points);
+    geometry->owned_points = NULL;
+    geometry->points = NULL;
+}
+
+// Splits a residue into theta_index and indice_circunferencia. residue / angular_divisions
+// is (residue * angle_reciprocal) >> 40, exact since residue < 2^20 and
+// angular_divisions <= 2^20 keep the rounding error of the reciprocal below 1 / angular_divisions.
+static void geometry_split(const struct mapper_geometry* geometry, int residue, int* theta_out, int* ring_out) {
+    int ring = (int)(((unsigned long long)residue * geometry->angle_reciprocal) >> GEOMETRY_ANGLE_SHIFT);
+    *theta_out = residue - ring * geometry->angular_divisions;
+    *ring_out = ring;
+}
+
+// Residue of one decimal number in a geometry. The built-in geometry takes the
+// compile-time path; others reduce by their prepared divisor.
+static int geometry_residue_n(const struct mapper_geometry* geometry, const char* digits, size_t len) {
+    if (geometry->points == spiral_point_table) return spiral_residue_parallel_n(digits, len);
+    if (len < 2 * LARGE_MOD_PARALLEL_MIN_DIGITS) {
+        return calculate_large_mod_prepared_n(&geometry->cell_divisor, digits, len);
     }
-    *quotient_str_out = '\0';
+    return calculate_large_mod_parallel_n(digits, len, geometry->cell_count, 0);
+}
 
-    if (!large_num_str) return -1;
-    size_t len = strlen(large_num_str);
-    if (len == 0) return -1;
+static void mapper_report(enum mapper_error error, unsigned long long item);
 
-    for (size_t i = 0; i < len; ++i) {
-        if (!isdigit(large_num_str[i])) return -1;
+int map_to_cartesian_geometry(const struct mapper_geometry* geometry, const char* number_str,
+                              int* theta_out, int* ring_out, float* x_out, float* y_out) {
+    if (!geometry || !geometry->points || !number_str || !x_out || !y_out) {
+        mapper_report(MAPPER_ERROR_NULL_ARGUMENT, 0);
+        return -1;
     }
+    size_t len = strlen(number_str);
+    int residue = geometry_residue_n(geometry, number_str, len);
+    if (residue == -1) {
+        mapper_report(len == 0 ? MAPPER_ERROR_EMPTY_NUMBER : MAPPER_ERROR_INVALID_DIGIT, 0);
+        return -1;
+    }
+    int theta, ring;
+    geometry_split(geometry, residue, &theta, &ring);
+    if (theta_out) *theta_out = theta;
+    if (ring_out) *ring_out = ring;
+    *x_out = geometry->points[residue].x;
+    *y_out = geometry->points[residue].y;
+    return 0;
+}
 
-    if (divisor <= 0) return -1;
+// ---------------------------------------------------------------------------
+// Instrumentation, compiled in with -DMAPPER_STATS. Each thread counts into a block
+// of its own that only it writes, so counting takes no lock and no locked
+// instruction; mapper_stats_get sums the blocks of running threads with what
+// exited threads left behind. Otherwise the hooks are empty and compile away.
 
-    if (quotient_buffer_size < 2) return -1; // Min for "0" + null terminator
+#ifdef MAPPER_STATS
+static unsigned long long stats_clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
 
+// CPU cycles where the time-stamp counter exists, nanoseconds elsewhere.
+static inline unsigned long long stats_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return stats_clock_ns();
+#endif
+}
 
-    char temp_quotient_buffer[len + 1];
-    size_t temp_idx = 0;
-    long long current_dividend_segment = 0;
-    int has_started_quotient = 0;
+struct stats_block {
+    struct mapper_stats counts; // ticks_per_second unused
+    struct stats_block* next;
+};
 
-    for (size_t i = 0; i < len; ++i) {
-        int digit_val = large_num_str[i] - '0';
-        current_dividend_segment = current_dividend_segment * 10 + digit_val;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key; // Its destructor retires a thread's block
+static struct stats_block* stats_live; // Blocks of running threads
+static struct mapper_stats stats_exited; // Summed blocks of threads that have exited
+static unsigned long long stats_epoch_ticks; // Clock readings at the last reset, to
+static unsigned long long stats_epoch_ns;    // estimate ticks_per_second
+static __thread struct stats_block* stats_own;
 
-        int quotient_digit = current_dividend_segment / divisor;
+// Adds the counters of counts to sum and, with clear, zeroes them. counts may
+// belong to a running thread, so it is read and cleared with atomic accesses.
+static void stats_merge(struct mapper_stats* sum, struct mapper_stats* counts, int clear) {
+#define STATS_MERGE(field)                                                          \
+    do {                                                                            \
+        sum->field += __atomic_load_n(&counts->field, __ATOMIC_RELAXED);            \
+        if (clear) __atomic_store_n(&counts->field, 0, __ATOMIC_RELAXED);           \
+    } while (0)
+    for (int s = 0; s < MAPPER_STAGE_COUNT; ++s) STATS_MERGE(stage_ticks[s]);
+    STATS_MERGE(numbers);
+    STATS_MERGE(bytes);
+    for (int b = 0; b < MAPPER_STATS_LENGTH_BUCKETS; ++b) STATS_MERGE(lengths[b]);
+    for (int e = 0; e < MAPPER_ERROR_KINDS; ++e) STATS_MERGE(errors[e]);
+    STATS_MERGE(wall_ns);
+#undef STATS_MERGE
+}
 
-        if (quotient_digit > 0 || has_started_quotient) {
-            if (temp_idx < len) {
-                 temp_quotient_buffer[temp_idx++] = quotient_digit + '0';
-            } else {
-                // This case implies quotient is longer than input, which shouldn't happen for divisor > 1.
-                // If divisor is 1, quotient length can be same as input.
-                // If len is 0, this block is not entered.
-                // If temp_idx reaches len, it means quotient has 'len' digits.
-            }
-            has_started_quotient = 1;
+static void stats_thread_exit(void* arg) {
+    struct stats_block* block = arg;
+    pthread_mutex_lock(&stats_lock);
+    stats_merge(&stats_exited, &block->counts, 0);
+    for (struct stats_block** link = &stats_live; *link; link = &(*link)->next) {
+        if (*link == block) {
+            *link = block->next;
+            break;
         }
-        current_dividend_segment = current_dividend_segment % divisor;
     }
+    pthread_mutex_unlock(&stats_lock);
+    free(block);
+}
 
-    if (temp_idx == 0) {
-        // This handles cases like "5" / 10 = "0" or "0" / N = "0"
-        // temp_quotient_buffer must have space for at least "0" and '\0'
-        if (len >= 0 && temp_idx < (len +1) ) { // Check temp_idx is within bounds for the buffer
-             temp_quotient_buffer[temp_idx++] = '0';
-        } else {
-            // This should not be reached if quotient_buffer_size >= 2 and len+1 buffer is used
-            return -1; // Should not happen
-        }
-    }
+static void stats_init(void) {
+    pthread_key_create(&stats_key, stats_thread_exit);
+    stats_epoch_ticks = stats_ticks();
+    stats_epoch_ns = stats_clock_ns();
+}
 
-    // Null terminate the temporary buffer
-    if (temp_idx < (len + 1)) { // Ensure temp_idx is within bounds of temp_quotient_buffer
-        temp_quotient_buffer[temp_idx] = '\0';
-    } else {
-        // This means temp_idx has gone out of bounds for temp_quotient_buffer.
-        // This would be an error in logic if temp_quotient_buffer is size len+1.
-        return -1;
-    }
+// The calling thread's counters, registered on first use; NULL if they cannot be
+// allocated, in which case the thread counts nothing.
+static struct mapper_stats* stats_thread(void) {
+    if (stats_own) return &stats_own->counts;
+    pthread_once(&stats_once, stats_init);
+    struct stats_block* block = calloc(1, sizeof(*block));
+    if (!block) return NULL;
+    pthread_mutex_lock(&stats_lock);
+    block->next = stats_live;
+    stats_live = block;
+    pthread_mutex_unlock(&stats_lock);
+    pthread_setspecific(stats_key, block);
+    stats_own = block;
+    return &block->counts;
+}
 
-    if (strlen(temp_quotient_buffer) + 1 > quotient_buffer_size) {
-        return -1;
+// Only the owning thread writes its counters: a plain load and store, made atomic
+// so that mapper_stats_get may read them meanwhile.
+static inline void stats_add(unsigned long long* counter, unsigned long long amount) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static void stats_stage(enum mapper_stage stage, unsigned long long ticks) {
+    struct mapper_stats* counts = stats_thread();
+    if (counts) stats_add(&counts->stage_ticks[stage], ticks);
+}
+
+// count numbers of bytes bytes in all were mapped.
+static void stats_numbers(unsigned long long count, unsigned long long bytes) {
+    struct mapper_stats* counts = stats_thread();
+    if (!counts) return;
+    stats_add(&counts->numbers, count);
+    stats_add(&counts->bytes, bytes);
+}
+
+// Adds a mapped number of len bytes to the length histogram.
+static inline void stats_length(size_t len) {
+    struct mapper_stats* counts = stats_thread();
+    if (!counts || len == 0) return;
+    int bucket = 63 - __builtin_clzll((unsigned long long)len);
+    if (bucket >= MAPPER_STATS_LENGTH_BUCKETS) bucket = MAPPER_STATS_LENGTH_BUCKETS - 1;
+    stats_add(&counts->lengths[bucket], 1);
+}
+
+static void stats_error(enum mapper_error error) {
+    struct mapper_stats* counts = stats_thread();
+    if (counts && (int)error >= 0 && (int)error < MAPPER_ERROR_KINDS) stats_add(&counts->errors[error], 1);
+}
+
+// Adds the wall-clock time since start_ns (a stats_clock_ns reading).
+static void stats_wall(unsigned long long start_ns) {
+    struct mapper_stats* counts = stats_thread();
+    if (counts) stats_add(&counts->wall_ns, stats_clock_ns() - start_ns);
+}
+#else
+static inline unsigned long long stats_clock_ns(void) { return 0; }
+static inline unsigned long long stats_ticks(void) { return 0; }
+static inline void stats_stage(enum mapper_stage stage, unsigned long long ticks) { (void)stage; (void)ticks; }
+static inline void stats_numbers(unsigned long long count, unsigned long long bytes) { (void)count; (void)bytes; }
+static inline void stats_length(size_t len) { (void)len; }
+static inline void stats_error(enum mapper_error error) { (void)error; }
+static inline void stats_wall(unsigned long long start_ns) { (void)start_ns; }
+#endif
+
+const char* mapper_stage_name(enum mapper_stage stage) {
+    switch (stage) {
+    case MAPPER_STAGE_READ:
+        return "read";
+    case MAPPER_STAGE_SPLIT:
+        return "split";
+    case MAPPER_STAGE_REDUCE:
+        return "reduce";
+    case MAPPER_STAGE_DIVIDE:
+        return "divide";
+    case MAPPER_STAGE_FORMAT:
+        return "format";
+    case MAPPER_STAGE_WRITE:
+        return "write";
+    case MAPPER_STAGE_COUNT:
+        break;
     }
-    strcpy(quotient_str_out, temp_quotient_buffer);
+    return "unknown";
+}
 
+int mapper_stats_get(struct mapper_stats* stats_out) {
+    if (!stats_out) return -1;
+    memset(stats_out, 0, sizeof(*stats_out));
+#ifdef MAPPER_STATS
+    pthread_once(&stats_once, stats_init);
+    pthread_mutex_lock(&stats_lock);
+    stats_merge(stats_out, &stats_exited, 0);
+    for (struct stats_block* block = stats_live; block; block = block->next) stats_merge(stats_out, &block->counts, 0);
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned long long elapsed_ns = stats_clock_ns() - stats_epoch_ns;
+    unsigned long long elapsed_ticks = stats_ticks() - stats_epoch_ticks;
+    stats_out->ticks_per_second = elapsed_ns > 0 ? (double)elapsed_ticks * 1e9 / (double)elapsed_ns : 0.0;
+#else
+    stats_out->ticks_per_second = 1e9;
+#endif
+    pthread_mutex_unlock(&stats_lock);
     return 0;
+#else
+    return -1;
+#endif
 }
 
-// Pre-calculated sine and cosine tables (from mapper.c)
-const float sin_table[40] = {
-    0.00000000,  0.15643447,  0.30901699,  0.45399050,  0.58778525,
-    0.70710677,  0.80901699,  0.89100651,  0.95105652,  0.98768834,
-    1.00000000,  0.98768834,  0.95105652,  0.89100651,  0.80901699,
-    0.70710677,  0.58778525,  0.45399050,  0.30901699,  0.15643447,
-    0.00000000, -0.15643445, -0.30901702, -0.45399053, -0.58778528,
-   -0.70710683, -0.80901702, -0.89100657, -0.95105658, -0.98768837,
-   -1.00000000, -0.98768837, -0.95105658, -0.89100657, -0.80901702,
-   -0.70710683, -0.58778528, -0.45399053, -0.30901702, -0.15643445
-};
+void mapper_stats_reset(void) {
+#ifdef MAPPER_STATS
+    pthread_once(&stats_once, stats_init);
+    struct mapper_stats discarded = {0};
+    pthread_mutex_lock(&stats_lock);
+    memset(&stats_exited, 0, sizeof(stats_exited));
+    for (struct stats_block* block = stats_live; block; block = block->next) stats_merge(&discarded, &block->counts, 1);
+    stats_epoch_ticks = stats_ticks();
+    stats_epoch_ns = stats_clock_ns();
+    pthread_mutex_unlock(&stats_lock);
+#endif
+}
 
-const float cos_table[40] = {
-    1.00000000,  0.98768834,  0.95105652,  0.89100651,  0.80901699,
-    0.70710677,  0.58778525,  0.45399050,  0.30901699,  0.15643447,
-    0.00000000, -0.15643447, -0.30901699, -0.45399050, -0.58778525,
-   -0.70710677, -0.80901699, -0.89100651, -0.95105652, -0.98768834,
-   -1.00000000, -0.98768834, -0.95105652, -0.89100651, -0.80901699,
-   -0.70710677, -0.58778525, -0.45399050, -0.30901699, -0.15643447,
-    0.00000000,  0.15643447,  0.30901699,  0.45399050,  0.58778525,
-    0.70710677,  0.80901699,  0.89100651,  0.95105652,  0.98768834
+// Where the convenience functions report failures; see mapper_set_diagnostic. A
+// handler and its context are published together as one immutable target behind
+// an atomic pointer, so reporting takes one acquire load and no lock. A target
+// may still be in use by a report when it is replaced, so it is never freed;
+// each one keeps the one it replaced reachable.
+struct diagnostic_target {
+    mapper_diagnostic_fn handler;
+    void* context;
+    const struct diagnostic_target* replaced;
 };
 
+static const struct diagnostic_target diagnostic_default = { mapper_diagnostic_stderr, NULL, NULL };
+static const struct diagnostic_target* diagnostic_current = &diagnostic_default;
+
+void mapper_set_diagnostic(mapper_diagnostic_fn handler, void* context) {
+    struct diagnostic_target* target = malloc(sizeof(*target));
+    if (!target) return;
+    target->handler = handler;
+    target->context = context;
+    target->replaced = __atomic_load_n(&diagnostic_current, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&diagnostic_current, &target->replaced, target, 0, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+const char* mapper_error_string(enum mapper_error error) {
+    switch (error) {
+    case MAPPER_OK:
+        return "no error";
+    case MAPPER_ERROR_NULL_ARGUMENT:
+        return "NULL argument";
+    case MAPPER_ERROR_EMPTY_NUMBER:
+        return "empty number";
+    case MAPPER_ERROR_INVALID_DIGIT:
+        return "invalid digit";
+    case MAPPER_ERROR_SHORT_RECORD:
+        return "incomplete record";
+    case MAPPER_ERROR_SCRATCH_TOO_SMALL:
+        return "scratch space too small";
+    case MAPPER_ERROR_READ:
+        return "read error";
+    }
+    return "unknown error";
+}
+
+void mapper_diagnostic_stderr(void* context, enum mapper_error error, unsigned long long item) {
+    (void)context;
+    if (item == 0) {
+        fprintf(stderr, "Error: cannot map number: %s\n", mapper_error_string(error));
+    } else if (error == MAPPER_ERROR_SHORT_RECORD) {
+        fprintf(stderr, "Error: incomplete record %llu\n", item);
+    } else {
+        fprintf(stderr, "Error: invalid number on line %llu\n", item);
+    }
+}
+
+static void mapper_report(enum mapper_error error, unsigned long long item) {
+    stats_error(error);
+    const struct diagnostic_target* target = __atomic_load_n(&diagnostic_current, __ATOMIC_ACQUIRE);
+    if (!target->handler) return;
+    target->handler(target->context, error, item);
+}
+
+enum mapper_error mapper_core_map(enum mapper_input_format format, const char* data, size_t len,
+                                  struct mapper_cell* cell_out) {
+    if (!data || !cell_out) return MAPPER_ERROR_NULL_ARGUMENT;
+    if (len == 0) return MAPPER_ERROR_EMPTY_NUMBER;
+    int residue;
+    switch (format) {
+    case MAPPER_INPUT_HEX:
+        if (len == 2 && data[0] == '0' && (data[1] == 'x' || data[1] == 'X')) return MAPPER_ERROR_EMPTY_NUMBER;
+        residue = calculate_large_mod_hex_n(data, len, SPIRAL_PERIOD);
+        break;
+    case MAPPER_INPUT_BINARY:
+        residue = calculate_large_mod_bytes((const unsigned char*)data, len, SPIRAL_PERIOD);
+        break;
+    default:
+        residue = spiral_residue_n(data, len);
+        break;
+    }
+    if (residue == -1) return MAPPER_ERROR_INVALID_DIGIT;
+    cell_out->theta = residue % SPIRAL_ANGULAR_DIVISIONS;
+    cell_out->ring = residue / SPIRAL_ANGULAR_DIVISIONS;
+    cell_out->x = spiral_point_table[residue].x;
+    cell_out->y = spiral_point_table[residue].y;
+    return MAPPER_OK;
+}
+
 // Function to map a large number string to Cartesian coordinates (from mapper.c)
+// theta_index = N % 40 and indice_circunferencia = (N / 40) % 77 both follow from
+// N % 3080, so the input is scanned once and (x, y) is read from spiral_point_table.
+// The result is bit-identical to R_efetivo * cos_table[theta_index] (and sin_table).
 int map_to_cartesian(const char* number_str, float *x_out, float *y_out) {
     if (number_str == NULL || x_out == NULL || y_out == NULL) {
-        fprintf(stderr, "Error: NULL argument passed to map_to_cartesian.\n");
+        mapper_report(MAPPER_ERROR_NULL_ARGUMENT, 0);
         return -1;
     }
-    size_t num_len = strlen(number_str);
-    if (num_len == 0) {
-        fprintf(stderr, "Error: Empty number string passed to map_to_cartesian.\n");
+    if (*number_str == '\0') {
+        mapper_report(MAPPER_ERROR_EMPTY_NUMBER, 0);
         return -1;
     }
 
-    int theta_index = calculate_large_mod(number_str, 40);
-    if (theta_index == -1) {
-        fprintf(stderr, "Error: calculate_large_mod failed for input %s\n", number_str);
+    size_t len = strlen(number_str);
+    unsigned long long start = stats_ticks();
+    int residue = spiral_residue_parallel_n(number_str, len);
+    unsigned long long reduced = stats_ticks();
+    stats_stage(MAPPER_STAGE_REDUCE, reduced - start);
+    if (residue == -1) {
+        mapper_report(MAPPER_ERROR_INVALID_DIGIT, 0);
         return -1;
     }
 
-    size_t radius_buf_size = num_len + 1;
-    if (radius_buf_size < 2) {
-        radius_buf_size = 2;
-    }
-    char actual_radius_buffer[radius_buf_size];
+    *x_out = spiral_point_table[residue].x;
+    *y_out = spiral_point_table[residue].y;
+    stats_stage(MAPPER_STAGE_FORMAT, stats_ticks() - reduced);
+    stats_numbers(1, len);
+    stats_length(len);
+
+    return 0;
+}
+
+// Gross radius mapping of the (already validated) digits[0..len) with radius
+// floor(N / 40). theta_index = N % 40 needs only the last three digits, since 40
+// divides 1000, and the radius is rounded from the leading digits, so no step is
+// linear in len except the digit check. Axis-aligned angles give exactly 0 rather
+// than inf * 0, and a zero radius gives 0 rather than -0.
+static void gross_point(const char* digits, size_t len, double radius, int* theta_out, double* x_out,
+                        double* y_out) {
+    size_t tail = len < 3 ? len : 3;
+    int theta = calculate_large_mod_n(digits + len - tail, tail, SPIRAL_ANGULAR_DIVISIONS);
+    *theta_out = theta;
+    *x_out = cos_table[theta] == 0.0f ? 0.0 : radius * cos_table[theta] + 0.0;
+    *y_out = sin_table[theta] == 0.0f ? 0.0 : radius * sin_table[theta] + 0.0;
+}
 
-    if (calculate_large_div_to_string(number_str, 40, actual_radius_buffer, radius_buf_size) == -1) {
-        fprintf(stderr, "Error: calculate_large_div_to_string failed for input %s (gross radius calculation)\n", number_str);
+static int map_gross_n(const char* digits, size_t len, int* theta_out, double* radius_out, double* log10_out,
+                       double* x_out, double* y_out) {
+    if (calculate_large_div_to_double_n(digits, len, SPIRAL_ANGULAR_DIVISIONS, radius_out, log10_out) == -1) {
         return -1;
     }
+    gross_point(digits, len, *radius_out, theta_out, x_out, y_out);
+    return 0;
+}
+
+enum mapper_error mapper_core_map_gross(const char* digits, size_t len, char* scratch, size_t scratch_size,
+                                        int* theta_out, double* radius_out, double* log10_out, double* x_out,
+                                        double* y_out) {
+    if (!digits || !theta_out || !radius_out || !x_out || !y_out) return MAPPER_ERROR_NULL_ARGUMENT;
+    if (len == 0) return MAPPER_ERROR_EMPTY_NUMBER;
+    int ret = calculate_large_div_to_double_scratch_n(digits, len, SPIRAL_ANGULAR_DIVISIONS, radius_out, log10_out,
+                                                      scratch, scratch_size);
+    if (ret == LARGE_DIV_DOUBLE_NEEDS_SCRATCH) return MAPPER_ERROR_SCRATCH_TOO_SMALL;
+    if (ret == -1) return MAPPER_ERROR_INVALID_DIGIT;
+    gross_point(digits, len, *radius_out, theta_out, x_out, y_out);
+    return MAPPER_OK;
+}
 
-    int indice_circunferencia = calculate_large_mod(actual_radius_buffer, 77);
-    if (indice_circunferencia == -1) {
-        fprintf(stderr, "Error: Failed to calculate indice_circunferencia from radius_str '%s'\n", actual_radius_buffer);
+int map_to_cartesian_gross(const char* number_str, int* theta_out, double* radius_out, double* log10_out,
+                           double* x_out, double* y_out) {
+    if (!number_str || !theta_out || !radius_out || !x_out || !y_out) {
+        mapper_report(MAPPER_ERROR_NULL_ARGUMENT, 0);
         return -1;
     }
+    size_t len = strlen(number_str);
+    unsigned long long start = stats_ticks();
+    int mapped = map_gross_n(number_str, len, theta_out, radius_out, log10_out, x_out, y_out);
+    stats_stage(MAPPER_STAGE_DIVIDE, stats_ticks() - start);
+    if (mapped == -1) {
+        mapper_report(len == 0 ? MAPPER_ERROR_EMPTY_NUMBER : MAPPER_ERROR_INVALID_DIGIT, 0);
+        return -1;
+    }
+    stats_numbers(1, len);
+    stats_length(len);
+    return 0;
+}
 
-    float R_efetivo = (float)indice_circunferencia + 1.0f;
+int map_to_cartesian_hex(const char* hex_str, float* x_out, float* y_out) {
+    struct mapper_cell cell;
+    enum mapper_error error = !hex_str || !x_out || !y_out
+                                  ? MAPPER_ERROR_NULL_ARGUMENT
+                                  : mapper_core_map(MAPPER_INPUT_HEX, hex_str, strlen(hex_str), &cell);
+    if (error != MAPPER_OK) {
+        mapper_report(error, 0);
+        return -1;
+    }
+    *x_out = cell.x;
+    *y_out = cell.y;
+    return 0;
+}
 
-    if (theta_index < 0 || theta_index >= 40) {
-        fprintf(stderr, "Error: Invalid theta_index %d calculated for input %s. This should not happen.\n", theta_index, number_str);
+int map_to_cartesian_bytes(const unsigned char* bytes, size_t len, float* x_out, float* y_out) {
+    struct mapper_cell cell;
+    enum mapper_error error = !x_out || !y_out ? MAPPER_ERROR_NULL_ARGUMENT
+                                               : mapper_core_map(MAPPER_INPUT_BINARY, (const char*)bytes, len, &cell);
+    if (error != MAPPER_OK) {
+        mapper_report(error, 0);
         return -1;
     }
+    *x_out = cell.x;
+    *y_out = cell.y;
+    return 0;
+}
 
-    *x_out = R_efetivo * cos_table[theta_index];
-    *y_out = R_efetivo * sin_table[theta_index];
+// Block size for reading a single number from a FILE.
+#define MAPPER_READ_BLOCK 16384
+
+// Reduces the single number read from in modulo SPIRAL_PERIOD, MAPPER_READ_BLOCK
+// bytes at a time, so memory use does not depend on its length. One "\n" or
+// "\r\n" at the end is allowed. Returns the residue, or -1 with *error_out set on
+// a read error, no digits, or any other non-digit.
+static int spiral_residue_file(FILE* in, enum mapper_error* error_out) {
+    char block[MAPPER_READ_BLOCK];
+    struct large_reducer red;
+    large_reducer_init(&red, SPIRAL_PERIOD, NULL, 0);
+
+    // "\r" and "\n" bytes at the end of a block are held back until it is known
+    // whether digits follow them; feeding them fails the reduction.
+    char held[2];
+    size_t held_len = 0;
+    int fed = 0;
+    size_t got;
+    while ((got = fread(block, 1, sizeof(block), in)) > 0) {
+        size_t end = got;
+        while (end > 0 && got - end < 2 && (block[end - 1] == '\n' || block[end - 1] == '\r')) end--;
+        if (end > 0) {
+            large_reducer_feed(&red, held, held_len);
+            held_len = 0;
+            large_reducer_feed(&red, block, end);
+            fed = 1;
+        }
+        for (size_t i = end; i < got; ++i) {
+            if (held_len < sizeof(held)) {
+                held[held_len++] = block[i];
+            } else {
+                large_reducer_feed(&red, block + i, 1);
+                fed = 1;
+            }
+        }
+    }
+    if (ferror(in)) {
+        *error_out = MAPPER_ERROR_READ;
+        return -1;
+    }
+    int terminator_ok = held_len == 0 || (held_len == 1 && held[0] == '\n') ||
+                        (held_len == 2 && held[0] == '\r' && held[1] == '\n');
+    int residue = large_reducer_finish(&red);
+    if (!terminator_ok || residue == -1) {
+        *error_out = fed || !terminator_ok ? MAPPER_ERROR_INVALID_DIGIT : MAPPER_ERROR_EMPTY_NUMBER;
+        return -1;
+    }
+    return residue;
+}
 
+int map_to_cartesian_file(FILE* in, float* x_out, float* y_out) {
+    if (!in || !x_out || !y_out) {
+        mapper_report(MAPPER_ERROR_NULL_ARGUMENT, 0);
+        return -1;
+    }
+    enum mapper_error error;
+    int residue = spiral_residue_file(in, &error);
+    if (residue == -1) {
+        mapper_report(error, 0);
+        return -1;
+    }
+    *x_out = spiral_point_table[residue].x;
+    *y_out = spiral_point_table[residue].y;
     return 0;
 }
 
-// Main function (from mapper.c)
-int main() {
-    const char* large_num_input = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
-    float x_coord, y_coord;
+// Batches smaller than this per thread are not worth a thread start.
+#define MAPPER_BATCH_MIN_PER_THREAD 4096
 
-    printf("Attempting to map large number: %s\n", large_num_input);
+// One contiguous slice of a batch. At most one of number_strs and buffer is set;
+// with neither, the batch is the consecutive integers whose first one has
+// residue range_first_residue, and status_out is unused.
+struct batch_job {
+    const char* const* number_strs;
+    const char* buffer;
+    const size_t* offsets;
+    float* x_out;
+    float* y_out;
+    int* status_out;
+    size_t begin;
+    size_t end;
+    size_t failures;
+    int range_first_residue;
+};
 
-    int status = map_to_cartesian(large_num_input, &x_coord, &y_coord);
+// Consecutive integers step through the residues in order, so each one is a
+// table lookup with no parsing.
+static void map_range_slice(struct batch_job* job) {
+    unsigned long long start = stats_ticks();
+    int residue = (int)((job->range_first_residue + job->begin % SPIRAL_PERIOD) % SPIRAL_PERIOD);
+    for (size_t i = job->begin; i < job->end; ++i) {
+        job->x_out[i] = spiral_point_table[residue].x;
+        job->y_out[i] = spiral_point_table[residue].y;
+        if (++residue == SPIRAL_PERIOD) residue = 0;
+    }
+    job->failures = 0;
+    stats_stage(MAPPER_STAGE_FORMAT, stats_ticks() - start);
+    stats_numbers(job->end - job->begin, 0);
+}
 
-    if (status == 0) {
-        printf("Main: map_to_cartesian successful.\n");
-        printf("Main: Input Number String: %s\n", large_num_input);
+static void map_batch_range(struct batch_job* job) {
+    if (!job->number_strs && !job->buffer) {
+        map_range_slice(job);
+        return;
+    }
 
-        int theta_main = calculate_large_mod(large_num_input, 40);
-        printf("Main: Theta Index (from calculate_large_mod): %d\n", theta_main);
-        if (theta_main != -1) {
-             printf("Main: Angle (degrees): %d\n", theta_main * 9);
-             if (theta_main >= 0 && theta_main < 40) {
-                printf("Main: Cos_val from table at index %d: %.8f\n", theta_main, cos_table[theta_main]);
-                printf("Main: Sin_val from table at index %d: %.8f\n", theta_main, sin_table[theta_main]);
-            } else {
-                printf("Main: Theta index %d is out of bounds for table lookup.\n", theta_main);
+    unsigned long long start = stats_ticks();
+    size_t failures = 0;
+    unsigned long long bytes = 0;
+    for (size_t i = job->begin; i < job->end; ++i) {
+        int residue = -1;
+        enum mapper_error error = MAPPER_ERROR_NULL_ARGUMENT;
+        size_t len = 0;
+        if (job->number_strs) {
+            if (job->number_strs[i]) {
+                len = strlen(job->number_strs[i]);
+                residue = spiral_residue_n(job->number_strs[i], len);
+                error = len == 0 ? MAPPER_ERROR_EMPTY_NUMBER : MAPPER_ERROR_INVALID_DIGIT;
             }
+        } else if (job->offsets[i + 1] >= job->offsets[i]) {
+            len = job->offsets[i + 1] - job->offsets[i];
+            residue = spiral_residue_n(job->buffer + job->offsets[i], len);
+            error = len == 0 ? MAPPER_ERROR_EMPTY_NUMBER : MAPPER_ERROR_INVALID_DIGIT;
+        }
+
+        if (residue == -1) {
+            job->x_out[i] = 0.0f;
+            job->y_out[i] = 0.0f;
+            job->status_out[i] = -1;
+            failures++;
+            stats_error(error);
         } else {
-            printf("Main: Error calculating theta_index for verification.\n");
+            bytes += len;
+            stats_length(len);
+            job->x_out[i] = spiral_point_table[residue].x;
+            job->y_out[i] = spiral_point_table[residue].y;
+            job->status_out[i] = 0;
         }
+    }
+    job->failures = failures;
+    stats_stage(MAPPER_STAGE_REDUCE, stats_ticks() - start);
+    stats_numbers(job->end - job->begin - failures, bytes);
+}
 
-        size_t input_len = strlen(large_num_input);
-        size_t gross_radius_buf_size = input_len + 1;
-        if (gross_radius_buf_size < 2) gross_radius_buf_size = 2;
+static void* batch_worker(void* arg) {
+    map_batch_range((struct batch_job*)arg);
+    return NULL;
+}
 
-        char gross_radius_str_main[gross_radius_buf_size];
+// The thread count the parallel paths use: requested when positive, otherwise
+// one per online CPU (at least one).
+static int default_thread_count(int requested) {
+    if (requested > 0) return requested;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int)online : 1;
+}
 
-        if (calculate_large_div_to_string(large_num_input, 40, gross_radius_str_main, gross_radius_buf_size) == 0) {
-            printf("Main: Gross Radius String (calculated in main): %s\n", gross_radius_str_main);
+// Splits [0, count) of the batch described by proto into contiguous slices, one
+// per thread; the calling thread maps the first slice itself. A slice whose thread
+// cannot be started is mapped on the calling thread as well.
+static int run_batch(const struct batch_job* proto, size_t count, int num_threads) {
+    unsigned long long start_ns = stats_clock_ns();
+    num_threads = default_thread_count(num_threads);
+    size_t max_threads = count / MAPPER_BATCH_MIN_PER_THREAD;
+    if (max_threads < 1) max_threads = 1;
+    size_t thread_count = (size_t)num_threads < max_threads ? (size_t)num_threads : max_threads;
 
-            float gross_radius_as_float = strtof(gross_radius_str_main, NULL);
-            printf("Main: Gross Radius String '%s' as float (strtof): %f (scientific: %e)\n",
-                   gross_radius_str_main, gross_radius_as_float, gross_radius_as_float);
+    struct batch_job* jobs = NULL;
+    pthread_t* threads = NULL;
+    if (thread_count > 1) {
+        jobs = malloc(thread_count * sizeof(*jobs));
+        threads = malloc(thread_count * sizeof(*threads));
+        if (!jobs || !threads) {
+            free(jobs);
+            free(threads);
+            jobs = NULL;
+            thread_count = 1;
+        }
+    }
+    if (thread_count == 1) {
+        struct batch_job job = *proto;
+        job.begin = 0;
+        job.end = count;
+        map_batch_range(&job);
+        stats_wall(start_ns);
+        return job.failures > INT_MAX ? INT_MAX : (int)job.failures;
+    }
 
-            int indice_circunferencia_main = calculate_large_mod(gross_radius_str_main, 77);
-            if (indice_circunferencia_main != -1) {
-                printf("Main: Indice da Circunferencia (calculated in main from gross radius string): %d\n", indice_circunferencia_main);
-                float R_efetivo_main = (float)indice_circunferencia_main + 1.0f;
-                printf("Main: R_efetivo (calculated in main): %.8f\n", R_efetivo_main);
-            } else {
-                printf("Main: Error calculating Indice da Circunferencia for verification.\n");
+    size_t chunk = (count + thread_count - 1) / thread_count;
+    for (size_t t = 0; t < thread_count; ++t) {
+        jobs[t] = *proto;
+        jobs[t].begin = t * chunk < count ? t * chunk : count;
+        jobs[t].end = (t + 1) * chunk < count ? (t + 1) * chunk : count;
+    }
+
+    // threads[t] is only joined if its slice was handed to a new thread.
+    char* joinable = calloc(thread_count, 1);
+    for (size_t t = 1; t < thread_count; ++t) {
+        if (joinable && pthread_create(&threads[t], NULL, batch_worker, &jobs[t]) == 0) {
+            joinable[t] = 1;
+        }
+    }
+    map_batch_range(&jobs[0]);
+
+    size_t failures = jobs[0].failures;
+    for (size_t t = 1; t < thread_count; ++t) {
+        if (joinable && joinable[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            map_batch_range(&jobs[t]);
+        }
+        failures += jobs[t].failures;
+    }
+
+    free(joinable);
+    free(threads);
+    free(jobs);
+    stats_wall(start_ns);
+    return failures > INT_MAX ? INT_MAX : (int)failures;
+}
+
+static int batch_outputs_valid(float* x_out, float* y_out, int* status_out) {
+    return x_out != NULL && y_out != NULL && status_out != NULL;
+}
+
+int map_to_cartesian_batch(
+    const char* const* number_strs,
+    size_t count,
+    float* x_out,
+    float* y_out,
+    int* status_out,
+    int num_threads
+) {
+    if (count == 0) return 0;
+    if (!number_strs || !batch_outputs_valid(x_out, y_out, status_out)) return -1;
+
+    struct batch_job proto = { number_strs, NULL, NULL, x_out, y_out, status_out, 0, 0, 0, 0 };
+    return run_batch(&proto, count, num_threads);
+}
+
+int map_to_cartesian_batch_concat(
+    const char* buffer,
+    const size_t* offsets,
+    size_t count,
+    float* x_out,
+    float* y_out,
+    int* status_out,
+    int num_threads
+) {
+    if (count == 0) return 0;
+    if (!buffer || !offsets || !batch_outputs_valid(x_out, y_out, status_out)) return -1;
+
+    struct batch_job proto = { NULL, buffer, offsets, x_out, y_out, status_out, 0, 0, 0, 0 };
+    return run_batch(&proto, count, num_threads);
+}
+
+int map_to_cartesian_range(const char* first_str, size_t count, float* x_out, float* y_out, int num_threads) {
+    if (!first_str || !x_out || !y_out) return -1;
+    int first_residue = spiral_residue(first_str);
+    if (first_residue == -1) return -1;
+    if (count == 0) return 0;
+
+    struct batch_job proto = { NULL, NULL, NULL, x_out, y_out, NULL, 0, 0, 0, first_residue };
+    run_batch(&proto, count, num_threads);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Streaming: newline-delimited numbers in, one delimited row per number out.
+// A reader stage cuts the input into batches of whole lines, worker threads split,
+// map and format each batch, and the calling thread writes batches back in input
+// order. Batches live in a fixed ring of slots, so memory stays bounded no matter
+// how many lines are streamed. Input comes either from a FILE (copied into the
+// slot's own buffer) or from memory such as a mapped file, in which case batches
+// point straight into it and nothing is copied. A range source generates
+// consecutive integers instead of reading lines.
+// ---------------------------------------------------------------------------
+
+#define STREAM_BATCH_BYTES (1 << 20)
+#define STREAM_CELL_TEXT_MAX 64
+#define STREAM_GROSS_TEXT_MAX 128 // "theta,radius,log10_radius,x,y\n" in gross radius mode
+#define STREAM_BLANK_LINE -2
+#define STREAM_RANGE_BLOCK 65536
+
+enum stream_slot_state { SLOT_FREE, SLOT_FILLED, SLOT_DONE };
+
+// A line of text input, or a record of binary input.
+struct stream_line {
+    size_t start;
+    size_t len; // Without the '\n' or "\r\n"
+    int residue; // -1 if invalid, STREAM_BLANK_LINE if blank
+};
+
+struct stream_slot {
+    enum stream_slot_state state;
+    int last; // Final batch of the input
+
+    const char* data; // Whole lines: into input, or into the mapped source
+    size_t data_len;
+    char* input; // Copy of the lines read from a FILE
+    size_t input_cap;
+
+    struct stream_line* lines;
+    size_t line_count;
+    size_t line_cap;
+
+    unsigned long long range_offset; // Range source: first value is range_first + range_offset
+    size_t range_count;
+
+    char* output;
+    size_t output_len;
+    size_t output_cap;
+    size_t invalid_count;
+};
+
+struct stream_pipeline {
+    FILE* in; // NULL when reading from mapped or range_first
+    const char* mapped;
+    size_t mapped_len;
+    const char* range_first; // Without leading zeros
+    unsigned long long range_last_offset; // last - first
+    int range_first_residue;
+    size_t range_digits_max; // Digits of the last value, plus one for a final carry
+    enum mapper_input_format format;
+    size_t record_size; // MAPPER_INPUT_BINARY only
+    unsigned long long* histogram; // Histogram mode: cell counts, merged from the workers; no rows are written
+    const struct mapper_geometry* geometry; // Never NULL
+    int gross_radius; // Rows carry the gross radius N / 40 and coordinates scaled by it
+    char separator;
+    int failed; // Allocation or I/O failure; stops every stage
+
+    // "theta,ring,x,y\n" preformatted for each residue of the geometry
+    char (*cell_text)[STREAM_CELL_TEXT_MAX];
+    unsigned char* cell_text_len;
+
+    struct stream_slot* slots;
+    size_t slot_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    unsigned long long batches_filled;
+    unsigned long long next_to_map;
+    int reader_done;
+};
+
+static int grow_buffer(void** buf, size_t* cap, size_t needed, size_t elem_size) {
+    if (needed <= *cap) return 0;
+    size_t new_cap = *cap ? *cap : 1024;
+    while (new_cap < needed) new_cap *= 2;
+    void* grown = realloc(*buf, new_cap * elem_size);
+    if (!grown) return -1;
+    *buf = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+// Waits until slot is in the wanted state or the pipeline failed. Called with the lock held.
+static int stream_wait_for(struct stream_pipeline* p, struct stream_slot* slot, enum stream_slot_state wanted) {
+    while (slot->state != wanted && !p->failed) pthread_cond_wait(&p->changed, &p->lock);
+    return p->failed ? -1 : 0;
+}
+
+static void stream_fail(struct stream_pipeline* p) {
+    pthread_mutex_lock(&p->lock);
+    p->failed = 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Length of the whole lines (or binary records) at the start of data[0..len),
+// which may be 0.
+static size_t stream_whole_length(const struct stream_pipeline* p, const char* data, size_t len) {
+    if (p->format == MAPPER_INPUT_BINARY) return len - len % p->record_size;
+    while (len > 0 && data[len - 1] != '\n') len--;
+    return len;
+}
+
+// Fills slot with whole lines read from p->in, starting with the carried-over
+// start of a line cut off by the previous batch. Sets *eof at the end of input.
+static int stream_read_batch(struct stream_pipeline* p, struct stream_slot* slot,
+                             char** carry, size_t* carry_len, size_t* carry_cap, int* eof) {
+    size_t needed = *carry_len + 1 > STREAM_BATCH_BYTES ? *carry_len + 1 : STREAM_BATCH_BYTES;
+    if (grow_buffer((void**)&slot->input, &slot->input_cap, needed, 1) == -1) return -1;
+    memcpy(slot->input, *carry, *carry_len);
+    size_t len = *carry_len;
+    *carry_len = 0;
+
+    // A line longer than the whole slot grows it.
+    *eof = 0;
+    for (;;) {
+        size_t room = slot->input_cap - len;
+        if (room == 0) {
+            if (stream_whole_length(p, slot->input, len) > 0) break;
+            if (grow_buffer((void**)&slot->input, &slot->input_cap, slot->input_cap * 2, 1) == -1) return -1;
+            continue;
+        }
+        size_t got = fread(slot->input + len, 1, room, p->in);
+        len += got;
+        if (got < room) {
+            if (ferror(p->in)) return -1;
+            *eof = 1;
+            break;
+        }
+    }
+
+    if (!*eof) {
+        size_t line_end = stream_whole_length(p, slot->input, len);
+        if (grow_buffer((void**)carry, carry_cap, len - line_end, 1) == -1) return -1;
+        memcpy(*carry, slot->input + line_end, len - line_end);
+        *carry_len = len - line_end;
+        len = line_end;
+    }
+    slot->data = slot->input;
+    slot->data_len = len;
+    return 0;
+}
+
+// Points slot at the next STREAM_BATCH_BYTES or so of p->mapped, extended to the
+// end of the line (or record). Sets *eof when the batch reaches the end of the mapping.
+static void stream_map_batch(struct stream_pipeline* p, struct stream_slot* slot, size_t* offset, int* eof) {
+    size_t start = *offset;
+    size_t end = p->mapped_len;
+    if (p->format == MAPPER_INPUT_BINARY) {
+        size_t records = STREAM_BATCH_BYTES / p->record_size + 1;
+        if ((end - start) / p->record_size > records) end = start + records * p->record_size;
+    } else if (end - start > STREAM_BATCH_BYTES) {
+        const char* newline = memchr(p->mapped + start + STREAM_BATCH_BYTES, '\n',
+                                     end - start - STREAM_BATCH_BYTES);
+        if (newline) end = (size_t)(newline - p->mapped) + 1;
+    }
+    slot->data = p->mapped + start;
+    slot->data_len = end - start;
+    *offset = end;
+    *eof = (end == p->mapped_len);
+}
+
+// Assigns the next STREAM_RANGE_BLOCK values of the range to slot. Sets *eof
+// when the block ends at the last value.
+static void stream_range_batch(struct stream_pipeline* p, struct stream_slot* slot,
+                               unsigned long long* offset, int* eof) {
+    unsigned long long remaining = p->range_last_offset - *offset; // Values after the first
+    slot->range_offset = *offset;
+    slot->range_count = remaining < STREAM_RANGE_BLOCK ? (size_t)remaining + 1 : STREAM_RANGE_BLOCK;
+    slot->data_len = 0;
+    *eof = remaining < STREAM_RANGE_BLOCK;
+    *offset += slot->range_count;
+}
+
+static void* stream_reader(void* arg) {
+    struct stream_pipeline* p = arg;
+    char* carry = NULL; // Start of a line cut off at the end of the previous batch
+    size_t carry_len = 0;
+    size_t carry_cap = 0;
+    size_t mapped_offset = 0;
+    unsigned long long range_offset = 0;
+
+    for (unsigned long long seq = 0; ; ++seq) {
+        struct stream_slot* slot = &p->slots[seq % p->slot_count];
+        pthread_mutex_lock(&p->lock);
+        int waited = stream_wait_for(p, slot, SLOT_FREE);
+        pthread_mutex_unlock(&p->lock);
+        if (waited == -1) break;
+
+        int eof;
+        unsigned long long start = stats_ticks();
+        if (p->in) {
+            if (stream_read_batch(p, slot, &carry, &carry_len, &carry_cap, &eof) == -1) {
+                stream_fail(p);
+                break;
             }
+        } else if (p->range_first) {
+            stream_range_batch(p, slot, &range_offset, &eof);
         } else {
-            printf("Main: Error calculating Gross Radius String for verification.\n");
+            stream_map_batch(p, slot, &mapped_offset, &eof);
         }
+        stats_stage(MAPPER_STAGE_READ, stats_ticks() - start);
+        slot->last = eof;
 
-        printf("Main: X Coordinate (from map_to_cartesian with R_efetivo): %.8f\n", x_coord);
-        printf("Main: Y Coordinate (from map_to_cartesian with R_efetivo): %.8f\n", y_coord);
-    } else {
-        printf("Main: map_to_cartesian failed with status %d. Check stderr for details from the function.\n", status);
+        pthread_mutex_lock(&p->lock);
+        slot->state = SLOT_FILLED;
+        p->batches_filled = seq + 1;
+        if (eof) p->reader_done = 1;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+        if (eof) break;
     }
 
-    return status;
+    free(carry);
+    return NULL;
+}
+
+// Splits slot->data into fixed-size records; a short final record is kept so
+// that it is reported as invalid.
+static int stream_split_records(struct stream_slot* slot, size_t record_size) {
+    size_t count = (slot->data_len + record_size - 1) / record_size;
+    if (grow_buffer((void**)&slot->lines, &slot->line_cap, count, sizeof(*slot->lines)) == -1) return -1;
+    for (size_t i = 0; i < count; ++i) {
+        slot->lines[i].start = i * record_size;
+        slot->lines[i].len = (i + 1 < count) ? record_size : slot->data_len - i * record_size;
+    }
+    slot->line_count = count;
+    return 0;
+}
+
+// Splits slot->data into lines, dropping the '\n' (and a preceding '\r').
+static int stream_split_lines(struct stream_slot* slot) {
+    slot->line_count = 0;
+    size_t start = 0;
+    while (start < slot->data_len) {
+        const char* newline = memchr(slot->data + start, '\n', slot->data_len - start);
+        size_t end = newline ? (size_t)(newline - slot->data) : slot->data_len;
+        size_t len = end - start;
+        if (len > 0 && slot->data[end - 1] == '\r') len--;
+
+        if (grow_buffer((void**)&slot->lines, &slot->line_cap, slot->line_count + 1, sizeof(*slot->lines)) == -1) {
+            return -1;
+        }
+        slot->lines[slot->line_count].start = start;
+        slot->lines[slot->line_count].len = len;
+        slot->line_count++;
+        start = end + 1;
+    }
+    return 0;
+}
+
+// Splits slot->data into lines, or records for binary input.
+static int stream_split(const struct stream_pipeline* p, struct stream_slot* slot) {
+    unsigned long long start = stats_ticks();
+    int split = p->format == MAPPER_INPUT_BINARY ? stream_split_records(slot, p->record_size) : stream_split_lines(slot);
+    stats_stage(MAPPER_STAGE_SPLIT, stats_ticks() - start);
+    return split;
+}
+
+// Writes a row for each value of the slot's range block. The block's first value is
+// found with one big-number add; after that each value is the previous one plus one,
+// so the decimal digits are incremented in place and the residue steps by one.
+static int stream_map_range_slot(struct stream_pipeline* p, struct stream_slot* slot) {
+    size_t row_max = p->range_digits_max + 1 + STREAM_CELL_TEXT_MAX;
+    if (grow_buffer((void**)&slot->output, &slot->output_cap, slot->range_count * row_max, 1) == -1) return -1;
+    size_t number_cap = p->range_digits_max + 22;
+    if (grow_buffer((void**)&slot->input, &slot->input_cap, number_cap, 1) == -1) return -1;
+
+    // The current value is kept right-aligned in input, ending at number_end.
+    if (calculate_large_add_to_string(p->range_first, slot->range_offset, slot->input, slot->input_cap) == -1) return -1;
+    size_t len = strlen(slot->input);
+    char* number_end = slot->input + slot->input_cap;
+    char* number = number_end - len;
+    memmove(number, slot->input, len);
+
+    int period = p->geometry->cell_count;
+    int residue = (int)((p->range_first_residue + slot->range_offset % (unsigned)period) % (unsigned)period);
+    char* out = slot->output;
+    unsigned long long start = stats_ticks();
+    unsigned long long bytes = 0;
+    for (size_t i = 0; i < slot->range_count; ++i) {
+        memcpy(out, number, (size_t)(number_end - number));
+        out += number_end - number;
+        bytes += (size_t)(number_end - number);
+        stats_length((size_t)(number_end - number));
+        *out++ = p->separator;
+        memcpy(out, p->cell_text[residue], p->cell_text_len[residue]);
+        out += p->cell_text_len[residue];
+
+        char* digit = number_end - 1;
+        while (digit >= number && *digit == '9') *digit-- = '0';
+        if (digit < number) {
+            *--number = '1';
+        } else {
+            (*digit)++;
+        }
+        if (++residue == period) residue = 0;
+    }
+    stats_stage(MAPPER_STAGE_FORMAT, stats_ticks() - start);
+    stats_numbers(slot->range_count, bytes);
+    slot->output_len = (size_t)(out - slot->output);
+    slot->line_count = 0;
+    slot->invalid_count = 0;
+    return 0;
+}
+
+// Residue of one line (or record) in the given input format, or -1.
+static int format_residue(enum mapper_input_format format, size_t record_size, const char* digits, size_t len) {
+    switch (format) {
+    case MAPPER_INPUT_HEX:
+        return calculate_large_mod_hex_n(digits, len, SPIRAL_PERIOD);
+    case MAPPER_INPUT_BINARY:
+        if (len != record_size) return -1;
+        return calculate_large_mod_bytes((const unsigned char*)digits, len, SPIRAL_PERIOD);
+    default:
+        // A line long enough to split (e.g. one huge number in a mapped file) is
+        // reduced by several threads; other lines take the serial path.
+        return spiral_residue_parallel_n(digits, len);
+    }
+}
+
+// Lines in another geometry are reduced by its cell count; decimal lines use its
+// prepared divisor.
+static int stream_line_residue(const struct stream_pipeline* p, const char* digits, size_t len) {
+    const struct mapper_geometry* geometry = p->geometry;
+    if (geometry->points == spiral_point_table) return format_residue(p->format, p->record_size, digits, len);
+    switch (p->format) {
+    case MAPPER_INPUT_HEX:
+        return calculate_large_mod_hex_n(digits, len, geometry->cell_count);
+    case MAPPER_INPUT_BINARY:
+        if (len != p->record_size) return -1;
+        return calculate_large_mod_bytes((const unsigned char*)digits, len, geometry->cell_count);
+    default:
+        return geometry_residue_n(geometry, digits, len);
+    }
+}
+
+// Copies the number column of a row to out: the line as read, or for binary
+// records their lowercase hex digits. Returns the end of what was written.
+static char* stream_write_number(const struct stream_pipeline* p, char* out, const char* digits, size_t len) {
+    if (p->format != MAPPER_INPUT_BINARY) {
+        memcpy(out, digits, len);
+        return out + len;
+    }
+    static const char hex_digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char byte = (unsigned char)digits[i];
+        *out++ = hex_digits[byte >> 4];
+        *out++ = hex_digits[byte & 0xF];
+    }
+    return out;
+}
+
+// Histogram mode: counts the slot's numbers per cell into counts, without
+// producing any output. Invalid lines are still marked for the writer to report.
+static int stream_count_slot(struct stream_pipeline* p, struct stream_slot* slot, unsigned long long* counts) {
+    if (stream_split(p, slot) == -1) return -1;
+    slot->output_len = 0;
+    slot->invalid_count = 0;
+    unsigned long long start = stats_ticks();
+    unsigned long long bytes = 0;
+    size_t numbers = 0;
+    for (size_t i = 0; i < slot->line_count; ++i) {
+        struct stream_line* line = &slot->lines[i];
+        if (line->len == 0) {
+            line->residue = STREAM_BLANK_LINE;
+            continue;
+        }
+        line->residue = stream_line_residue(p, slot->data + line->start, line->len);
+        if (line->residue == -1) {
+            slot->invalid_count++;
+            continue;
+        }
+        counts[line->residue]++;
+        numbers++;
+        bytes += line->len;
+        stats_length(line->len);
+    }
+    stats_stage(MAPPER_STAGE_REDUCE, stats_ticks() - start);
+    stats_numbers(numbers, bytes);
+    return 0;
+}
+
+// Gross radius mode: rows are formatted per number, as the radius is not a
+// function of the residue. Input is always decimal.
+static int stream_map_gross_slot(struct stream_pipeline* p, struct stream_slot* slot) {
+    if (stream_split(p, slot) == -1) return -1;
+    size_t needed = slot->data_len + slot->line_count * (STREAM_GROSS_TEXT_MAX + 1);
+    if (grow_buffer((void**)&slot->output, &slot->output_cap, needed, 1) == -1) return -1;
+
+    char* out = slot->output;
+    char separator = p->separator;
+    slot->invalid_count = 0;
+    // Each stage's ticks run from the end of the previous one.
+    unsigned long long mark = stats_ticks();
+    unsigned long long divide_ticks = 0, format_ticks = 0, bytes = 0;
+    size_t numbers = 0;
+    for (size_t i = 0; i < slot->line_count; ++i) {
+        struct stream_line* line = &slot->lines[i];
+        const char* digits = slot->data + line->start;
+        if (line->len == 0) {
+            line->residue = STREAM_BLANK_LINE;
+            continue;
+        }
+        int theta;
+        double radius, log10_radius, x, y;
+        int mapped = map_gross_n(digits, line->len, &theta, &radius, &log10_radius, &x, &y);
+        unsigned long long divided = stats_ticks();
+        divide_ticks += divided - mark;
+        mark = divided;
+        if (mapped == -1) {
+            line->residue = -1;
+            slot->invalid_count++;
+            continue;
+        }
+        line->residue = theta;
+        memcpy(out, digits, line->len);
+        out += line->len;
+        out += snprintf(out, STREAM_GROSS_TEXT_MAX + 1, "%c%d%c%.17g%c%.8f%c%.17g%c%.17g\n", separator, theta,
+                        separator, radius, separator, log10_radius, separator, x, separator, y);
+        unsigned long long formatted = stats_ticks();
+        format_ticks += formatted - mark;
+        mark = formatted;
+        numbers++;
+        bytes += line->len;
+        stats_length(line->len);
+    }
+    stats_stage(MAPPER_STAGE_DIVIDE, divide_ticks);
+    stats_stage(MAPPER_STAGE_FORMAT, format_ticks);
+    stats_numbers(numbers, bytes);
+    slot->output_len = (size_t)(out - slot->output);
+    return 0;
+}
+
+static int stream_map_slot(struct stream_pipeline* p, struct stream_slot* slot) {
+    if (p->range_first) return stream_map_range_slot(p, slot);
+    if (p->gross_radius) return stream_map_gross_slot(p, slot);
+    if (stream_split(p, slot) == -1) return -1;
+    size_t number_bytes = p->format == MAPPER_INPUT_BINARY ? 2 * slot->data_len : slot->data_len;
+    size_t needed = number_bytes + slot->line_count * (STREAM_CELL_TEXT_MAX + 1);
+    if (grow_buffer((void**)&slot->output, &slot->output_cap, needed, 1) == -1) return -1;
+
+    char* out = slot->output;
+    slot->invalid_count = 0;
+    // Each stage's ticks run from the end of the previous one.
+    unsigned long long mark = stats_ticks();
+    unsigned long long reduce_ticks = 0, format_ticks = 0, bytes = 0;
+    size_t numbers = 0;
+    for (size_t i = 0; i < slot->line_count; ++i) {
+        struct stream_line* line = &slot->lines[i];
+        const char* digits = slot->data + line->start;
+        if (line->len == 0) {
+            line->residue = STREAM_BLANK_LINE;
+            continue;
+        }
+        line->residue = stream_line_residue(p, digits, line->len);
+        unsigned long long reduced = stats_ticks();
+        reduce_ticks += reduced - mark;
+        mark = reduced;
+        if (line->residue == -1) {
+            slot->invalid_count++;
+            continue;
+        }
+        out = stream_write_number(p, out, digits, line->len);
+        *out++ = p->separator;
+        memcpy(out, p->cell_text[line->residue], p->cell_text_len[line->residue]);
+        out += p->cell_text_len[line->residue];
+        unsigned long long formatted = stats_ticks();
+        format_ticks += formatted - mark;
+        mark = formatted;
+        numbers++;
+        bytes += line->len;
+        stats_length(line->len);
+    }
+    stats_stage(MAPPER_STAGE_REDUCE, reduce_ticks);
+    stats_stage(MAPPER_STAGE_FORMAT, format_ticks);
+    stats_numbers(numbers, bytes);
+    slot->output_len = (size_t)(out - slot->output);
+    return 0;
+}
+
+static void* stream_worker(void* arg) {
+    struct stream_pipeline* p = arg;
+    // Histogram mode counts into this worker's own bins, merged once at the end.
+    unsigned long long* counts = NULL;
+    if (p->histogram) {
+        counts = calloc((size_t)p->geometry->cell_count, sizeof(*counts));
+        if (!counts) {
+            stream_fail(p);
+            return NULL;
+        }
+    }
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        while (!p->failed && p->next_to_map == p->batches_filled && !p->reader_done) {
+            pthread_cond_wait(&p->changed, &p->lock);
+        }
+        if (p->failed || p->next_to_map == p->batches_filled) {
+            if (p->histogram) {
+                for (int r = 0; r < p->geometry->cell_count; ++r) p->histogram[r] += counts[r];
+            }
+            pthread_mutex_unlock(&p->lock);
+            free(counts);
+            return NULL;
+        }
+        struct stream_slot* slot = &p->slots[p->next_to_map++ % p->slot_count];
+        pthread_mutex_unlock(&p->lock);
+
+        int mapped = p->histogram ? stream_count_slot(p, slot, counts) : stream_map_slot(p, slot);
+        if (mapped == -1) {
+            stream_fail(p);
+            free(counts);
+            return NULL;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+// Writes batches in input order until the last one. Runs on the calling thread.
+static size_t stream_write(struct stream_pipeline* p, FILE* out) {
+    size_t invalid_lines = 0;
+    unsigned long long line_no = 1;
+    for (unsigned long long seq = 0; ; ++seq) {
+        struct stream_slot* slot = &p->slots[seq % p->slot_count];
+        pthread_mutex_lock(&p->lock);
+        int waited = stream_wait_for(p, slot, SLOT_DONE);
+        pthread_mutex_unlock(&p->lock);
+        if (waited == -1) break;
+
+        unsigned long long start = stats_ticks();
+        if (slot->output_len > 0 && fwrite(slot->output, 1, slot->output_len, out) != slot->output_len) {
+            stream_fail(p);
+            break;
+        }
+        if (slot->invalid_count > 0) {
+            for (size_t i = 0; i < slot->line_count; ++i) {
+                if (slot->lines[i].residue != -1) continue;
+                mapper_report(p->format == MAPPER_INPUT_BINARY ? MAPPER_ERROR_SHORT_RECORD : MAPPER_ERROR_INVALID_DIGIT,
+                              line_no + i);
+            }
+            invalid_lines += slot->invalid_count;
+        }
+        stats_stage(MAPPER_STAGE_WRITE, stats_ticks() - start);
+        line_no += slot->line_count;
+        int last = slot->last;
+
+        pthread_mutex_lock(&p->lock);
+        slot->state = SLOT_FREE;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+        if (last) break;
+    }
+    return invalid_lines;
+}
+
+// Runs the reader, workers and writer over the source set in p (in, mapped or range_first).
+static int run_stream_pipeline(struct stream_pipeline* p, FILE* out, int num_threads) {
+    unsigned long long start_ns = stats_clock_ns();
+    num_threads = default_thread_count(num_threads);
+
+    const struct mapper_geometry* geometry = p->geometry;
+    size_t cell_count = p->histogram || p->gross_radius ? 0 : (size_t)geometry->cell_count;
+    p->slot_count = 2 * (size_t)num_threads + 2;
+    p->slots = calloc(p->slot_count, sizeof(*p->slots));
+    pthread_t* workers = calloc((size_t)num_threads, sizeof(*workers));
+    p->cell_text = malloc(cell_count * sizeof(*p->cell_text));
+    p->cell_text_len = malloc(cell_count);
+    if (!p->slots || !workers || (cell_count > 0 && (!p->cell_text || !p->cell_text_len))) {
+        free(p->cell_text);
+        free(p->cell_text_len);
+        free(workers);
+        free(p->slots);
+        return -1;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+
+    char separator = p->separator;
+    for (size_t r = 0; r < cell_count; ++r) {
+        int theta, ring;
+        geometry_split(geometry, (int)r, &theta, &ring);
+        int len = snprintf(p->cell_text[r], STREAM_CELL_TEXT_MAX, "%d%c%d%c%.8f%c%.8f\n", theta, separator, ring,
+                           separator, geometry->points[r].x, separator, geometry->points[r].y);
+        p->cell_text_len[r] = (unsigned char)len;
+    }
+
+    if (p->gross_radius) {
+        fprintf(out, "number%ctheta%cradius%clog10_radius%cx%cy\n", separator, separator, separator, separator,
+                separator);
+    } else if (!p->histogram) {
+        fprintf(out, "number%ctheta%cring%cx%cy\n", separator, separator, separator, separator);
+    }
+
+    pthread_t reader;
+    int reader_started = pthread_create(&reader, NULL, stream_reader, p) == 0;
+    int workers_started = 0;
+    for (int t = 0; t < num_threads && reader_started; ++t) {
+        if (pthread_create(&workers[t], NULL, stream_worker, p) != 0) break;
+        workers_started++;
+    }
+
+    size_t invalid_lines = 0;
+    if (!reader_started || workers_started == 0) {
+        stream_fail(p);
+    } else {
+        invalid_lines = stream_write(p, out);
+    }
+
+    if (reader_started) pthread_join(reader, NULL);
+    for (int t = 0; t < workers_started; ++t) pthread_join(workers[t], NULL);
+    int failed = p->failed || (out && (fflush(out) != 0 || ferror(out)));
+
+    for (size_t s = 0; s < p->slot_count; ++s) {
+        free(p->slots[s].input);
+        free(p->slots[s].lines);
+        free(p->slots[s].output);
+    }
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->lock);
+    free(p->cell_text);
+    free(p->cell_text_len);
+    free(p->slots);
+    free(workers);
+    stats_wall(start_ns);
+
+    if (failed) return -1;
+    return invalid_lines > INT_MAX ? INT_MAX : (int)invalid_lines;
+}
+
+int map_to_cartesian_stream(FILE* in, FILE* out, char separator, int num_threads) {
+    return map_to_cartesian_stream_format(in, out, separator, num_threads, MAPPER_INPUT_DECIMAL, 0);
+}
+
+int map_to_cartesian_stream_format(FILE* in, FILE* out, char separator, int num_threads,
+                                   enum mapper_input_format format, size_t record_size) {
+    return map_to_cartesian_stream_geometry(NULL, in, out, separator, num_threads, format, record_size);
+}
+
+int map_to_cartesian_stream_geometry(const struct mapper_geometry* geometry, FILE* in, FILE* out, char separator,
+                                     int num_threads, enum mapper_input_format format, size_t record_size) {
+    if (!in || !out || (geometry && !geometry->points)) return -1;
+    if (format == MAPPER_INPUT_BINARY && record_size == 0) return -1;
+
+    struct stream_pipeline* p = calloc(1, sizeof(*p));
+    if (!p) return -1;
+    p->geometry = geometry ? geometry : &spiral_geometry;
+    p->in = in;
+    p->format = format;
+    p->record_size = record_size;
+    p->separator = separator;
+    int ret = run_stream_pipeline(p, out, num_threads);
+    free(p);
+    return ret;
+}
+
+int map_to_cartesian_range_stream(const char* first_str, const char* last_str, FILE* out,
+                                  char separator, int num_threads) {
+    return map_to_cartesian_range_stream_geometry(NULL, first_str, last_str, out, separator, num_threads);
+}
+
+int map_to_cartesian_range_stream_geometry(const struct mapper_geometry* geometry, const char* first_str,
+                                           const char* last_str, FILE* out, char separator, int num_threads) {
+    unsigned long long last_offset;
+    if (!out || (geometry && !geometry->points)) return -1;
+    if (calculate_large_difference(first_str, last_str, &last_offset) == -1) return -1;
+    if (!geometry) geometry = &spiral_geometry;
+
+    while (first_str[0] == '0' && first_str[1] != '\0') first_str++;
+    size_t last_len = strlen(last_str);
+    while (last_len > 1 && *last_str == '0') {
+        last_str++;
+        last_len--;
+    }
+
+    struct stream_pipeline* p = calloc(1, sizeof(*p));
+    if (!p) return -1;
+    p->geometry = geometry;
+    p->range_first = first_str;
+    p->range_last_offset = last_offset;
+    p->range_first_residue = geometry_residue_n(geometry, first_str, strlen(first_str));
+    p->range_digits_max = last_len + 1;
+    p->separator = separator;
+    int ret = run_stream_pipeline(p, out, num_threads);
+    free(p);
+    return ret;
+}
+
+int map_to_cartesian_buffer(const char* data, size_t len, FILE* out, char separator, int num_threads) {
+    return map_to_cartesian_buffer_format(data, len, out, separator, num_threads, MAPPER_INPUT_DECIMAL, 0);
+}
+
+int map_to_cartesian_buffer_format(const char* data, size_t len, FILE* out, char separator, int num_threads,
+                                   enum mapper_input_format format, size_t record_size) {
+    return map_to_cartesian_buffer_geometry(NULL, data, len, out, separator, num_threads, format, record_size);
+}
+
+int map_to_cartesian_buffer_geometry(const struct mapper_geometry* geometry, const char* data, size_t len,
+                                     FILE* out, char separator, int num_threads,
+                                     enum mapper_input_format format, size_t record_size) {
+    if (!data || !out || (geometry && !geometry->points)) return -1;
+    if (format == MAPPER_INPUT_BINARY && record_size == 0) return -1;
+
+    struct stream_pipeline* p = calloc(1, sizeof(*p));
+    if (!p) return -1;
+    p->geometry = geometry ? geometry : &spiral_geometry;
+    p->mapped = data;
+    p->mapped_len = len;
+    p->format = format;
+    p->record_size = record_size;
+    p->separator = separator;
+    int ret = run_stream_pipeline(p, out, num_threads);
+    free(p);
+    return ret;
+}
+
+int map_to_cartesian_stream_gross(FILE* in, FILE* out, char separator, int num_threads) {
+    if (!in || !out) return -1;
+
+    struct stream_pipeline* p = calloc(1, sizeof(*p));
+    if (!p) return -1;
+    p->geometry = &spiral_geometry;
+    p->gross_radius = 1;
+    p->in = in;
+    p->format = MAPPER_INPUT_DECIMAL;
+    p->separator = separator;
+    int ret = run_stream_pipeline(p, out, num_threads);
+    free(p);
+    return ret;
+}
+
+int map_to_cartesian_buffer_gross(const char* data, size_t len, FILE* out, char separator, int num_threads) {
+    if (!data || !out) return -1;
+
+    struct stream_pipeline* p = calloc(1, sizeof(*p));
+    if (!p) return -1;
+    p->geometry = &spiral_geometry;
+    p->gross_radius = 1;
+    p->mapped = data;
+    p->mapped_len = len;
+    p->format = MAPPER_INPUT_DECIMAL;
+    p->separator = separator;
+    int ret = run_stream_pipeline(p, out, num_threads);
+    free(p);
+    return ret;
+}
+
+int map_to_cartesian_histogram(FILE* in, unsigned long long counts_out[MAPPER_CELL_COUNT], int num_threads,
+                               enum mapper_input_format format, size_t record_size) {
+    return map_to_cartesian_histogram_geometry(NULL, in, counts_out, num_threads, format, record_size);
+}
+
+int map_to_cartesian_histogram_buffer(const char* data, size_t len, unsigned long long counts_out[MAPPER_CELL_COUNT],
+                                      int num_threads, enum mapper_input_format format, size_t record_size) {
+    return map_to_cartesian_histogram_buffer_geometry(NULL, data, len, counts_out, num_threads, format, record_size);
+}
+
+int map_to_cartesian_histogram_geometry(const struct mapper_geometry* geometry, FILE* in,
+                                        unsigned long long* counts_out, int num_threads,
+                                        enum mapper_input_format format, size_t record_size) {
+    if (!in || !counts_out || (geometry && !geometry->points)) return -1;
+    if (format == MAPPER_INPUT_BINARY && record_size == 0) return -1;
+
+    struct stream_pipeline* p = calloc(1, sizeof(*p));
+    if (!p) return -1;
+    p->geometry = geometry ? geometry : &spiral_geometry;
+    memset(counts_out, 0, (size_t)p->geometry->cell_count * sizeof(counts_out[0]));
+    p->in = in;
+    p->format = format;
+    p->record_size = record_size;
+    p->histogram = counts_out;
+    int ret = run_stream_pipeline(p, NULL, num_threads);
+    free(p);
+    return ret;
+}
+
+int map_to_cartesian_histogram_buffer_geometry(const struct mapper_geometry* geometry, const char* data, size_t len,
+                                               unsigned long long* counts_out, int num_threads,
+                                               enum mapper_input_format format, size_t record_size) {
+    if (!data || !counts_out || (geometry && !geometry->points)) return -1;
+    if (format == MAPPER_INPUT_BINARY && record_size == 0) return -1;
+
+    struct stream_pipeline* p = calloc(1, sizeof(*p));
+    if (!p) return -1;
+    p->geometry = geometry ? geometry : &spiral_geometry;
+    memset(counts_out, 0, (size_t)p->geometry->cell_count * sizeof(counts_out[0]));
+    p->mapped = data;
+    p->mapped_len = len;
+    p->format = format;
+    p->record_size = record_size;
+    p->histogram = counts_out;
+    int ret = run_stream_pipeline(p, NULL, num_threads);
+    free(p);
+    return ret;
+}
+
+// One lit pixel of a density image: its row-major index and the hits summed into it.
+struct render_pixel {
+    size_t index;
+    unsigned long long hits;
+};
+
+static int compare_render_pixels(const void* a, const void* b) {
+    size_t ia = ((const struct render_pixel*)a)->index, ib = ((const struct render_pixel*)b)->index;
+    return (ia > ib) - (ia < ib);
+}
+
+// Sets the pixel at out to level on the PGM grey scale or the PPM colour ramp.
+static void render_level(unsigned char* out, enum mapper_image_format format, int level) {
+    if (format == MAPPER_IMAGE_PGM) {
+        out[0] = (unsigned char)level;
+        return;
+    }
+    for (int c = 0; c < 3; ++c) {
+        int v = 3 * level - 255 * c;
+        out[c] = (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+}
+
+// Only cells with hits are placed: they are sorted by pixel, so the image is
+// written a row at a time without a width x height framebuffer.
+int mapper_render_density(const struct mapper_geometry* geometry, const unsigned long long* counts, int width,
+                          int height, enum mapper_image_format format, FILE* out) {
+    if (!counts || !out || (geometry && !geometry->points)) return -1;
+    if (width < 1 || height < 1 || width > MAPPER_RENDER_MAX_SIDE || height > MAPPER_RENDER_MAX_SIDE) return -1;
+    if (!geometry) geometry = &spiral_geometry;
+
+    float extent = 0.0f;
+    for (int r = 0; r < geometry->cell_count; ++r) {
+        extent = fmaxf(extent, fmaxf(fabsf(geometry->points[r].x), fabsf(geometry->points[r].y)));
+    }
+    // [-extent, extent] spans the shorter side less one pixel, centred.
+    int side = width < height ? width : height;
+    double scale = extent > 0.0f ? (side - 1) / (2.0 * extent) : 0.0;
+
+    struct render_pixel* pixels = malloc((size_t)geometry->cell_count * sizeof(*pixels));
+    size_t channels = format == MAPPER_IMAGE_PGM ? 1 : 3;
+    unsigned char* row = malloc((size_t)width * channels);
+    if (!pixels || !row) {
+        free(pixels);
+        free(row);
+        return -1;
+    }
+    size_t lit = 0;
+    for (int r = 0; r < geometry->cell_count; ++r) {
+        if (counts[r] == 0) continue;
+        double px = floor(width / 2.0 + geometry->points[r].x * scale);
+        double py = floor(height / 2.0 - geometry->points[r].y * scale);
+        size_t x = px < 0 ? 0 : px >= width ? (size_t)width - 1 : (size_t)px;
+        size_t y = py < 0 ? 0 : py >= height ? (size_t)height - 1 : (size_t)py;
+        pixels[lit].index = y * (size_t)width + x;
+        pixels[lit].hits = counts[r];
+        lit++;
+    }
+    qsort(pixels, lit, sizeof(*pixels), compare_render_pixels);
+    size_t merged = 0;
+    unsigned long long densest = 0;
+    for (size_t i = 0; i < lit; ++i) {
+        if (merged > 0 && pixels[merged - 1].index == pixels[i].index) {
+            pixels[merged - 1].hits += pixels[i].hits;
+        } else {
+            pixels[merged++] = pixels[i];
+        }
+        if (pixels[merged - 1].hits > densest) densest = pixels[merged - 1].hits;
+    }
+    double log_densest = log1p((double)densest);
+
+    int ok = fprintf(out, "%s\n%d %d\n255\n", format == MAPPER_IMAGE_PGM ? "P5" : "P6", width, height) > 0;
+    size_t next = 0;
+    for (size_t y = 0; ok && y < (size_t)height; ++y) {
+        memset(row, 0, (size_t)width * channels);
+        size_t row_end = (y + 1) * (size_t)width;
+        for (; next < merged && pixels[next].index < row_end; ++next) {
+            int level = 1 + (int)lround(254.0 * log1p((double)pixels[next].hits) / log_densest);
+            render_level(row + (pixels[next].index - y * (size_t)width) * channels, format, level);
+        }
+        ok = fwrite(row, channels, (size_t)width, out) == (size_t)width;
+    }
+    free(pixels);
+    free(row);
+    return ok && fflush(out) == 0 ? 0 : -1;
+}
+
+// Range cell counts. The cell of N depends only on N mod 3080, so a range of len
+// integers starting at residue a gives every cell len / 3080 hits, plus one more for
+// the len % 3080 cells a, a + 1, ... (wrapping). Nothing is enumerated: the work is
+// a subtraction, a division and two remainders over the digits of the bounds.
+int map_to_cartesian_range_counts(const char* first_str, const char* last_str, char* base_out, size_t base_size,
+                                  unsigned char extra_out[MAPPER_CELL_COUNT]) {
+    if (!first_str || !last_str || !base_out || !extra_out) return -1;
+    size_t size = strlen(last_str) + 22;
+    char* difference = malloc(size);
+    char* length = malloc(size);
+
+    int ret = -1;
+    if (difference && length &&
+        calculate_large_difference_to_string(first_str, last_str, difference, size) == 0 &&
+        calculate_large_add_to_string(difference, 1, length, size) == 0 &&
+        calculate_large_div_to_string(length, SPIRAL_PERIOD, base_out, base_size) == 0) {
+        int extra = calculate_large_mod(length, SPIRAL_PERIOD);
+        int residue = spiral_residue(first_str);
+        memset(extra_out, 0, MAPPER_CELL_COUNT);
+        for (int i = 0; i < extra; ++i) extra_out[(residue + i) % SPIRAL_PERIOD] = 1;
+        ret = 0;
+    }
+    free(difference);
+    free(length);
+    return ret;
+}
+
+// The keys of cell c in the range are c + 3080 * m for consecutive m, starting at the
+// first m with c + 3080 * m >= first: first / 3080, or one more if c is below first's
+// residue. The k-th is then one multiply-add away.
+int map_to_cartesian_range_key(const char* first_str, const char* last_str, int theta, int ring,
+                               unsigned long long k, char* key_out, size_t key_size) {
+    if (!first_str || !last_str || !key_out) return -1;
+    if (theta < 0 || theta >= SPIRAL_ANGULAR_DIVISIONS || ring < 0 || ring >= SPIRAL_RING_COUNT) return -1;
+    int cell = theta + SPIRAL_ANGULAR_DIVISIONS * ring;
+    int residue = spiral_residue(first_str);
+    if (residue == -1) return -1;
+
+    // quotient + k + 1 fits in size, and key <= last leaves a difference that fits in last_size.
+    size_t size = strlen(first_str) + 22;
+    size_t last_size = strlen(last_str) + 1;
+    char* quotient = malloc(size);
+    char* multiple = malloc(size);
+    char* check = malloc(last_size);
+    int ret = -1;
+    if (quotient && multiple && check &&
+        calculate_large_div_to_string(first_str, SPIRAL_PERIOD, quotient, size) == 0 &&
+        calculate_large_add_to_string(quotient, k, multiple, size) == 0 &&
+        calculate_large_add_to_string(multiple, cell < residue ? 1 : 0, quotient, size) == 0 &&
+        calculate_large_mul_add_to_string(quotient, SPIRAL_PERIOD, (unsigned int)cell, key_out, key_size) == 0 &&
+        calculate_large_difference_to_string(key_out, last_str, check, last_size) == 0) { // key <= last
+        ret = 0;
+    }
+    if (ret == -1 && key_size > 0) *key_out = '\0';
+    free(quotient);
+    free(multiple);
+    free(check);
+    return ret;
+}
+
+// Maps the whole file at path read-only. An empty file gives "" (nothing to unmap).
+// Returns NULL if it cannot be opened, is not a regular file, or cannot be mapped.
+static const char* map_whole_file(const char* path, size_t* len_out, int advice) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    *len_out = (size_t)st.st_size;
+    if (*len_out == 0) {
+        close(fd);
+        return "";
+    }
+    void* data = mmap(NULL, *len_out, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    madvise(data, *len_out, advice);
+    return data;
+}
+
+static void unmap_whole_file(const char* data, size_t len) {
+    if (len > 0) munmap((void*)data, len);
+}
+
+// Cell index file layout, all integers little-endian uint64:
+//   "SPIRIDX1", record_size (0 for text keys), cell count,
+//   offsets[cell count + 1] into the key area, which follows directly.
+// Cell c holds keys offsets[c] .. offsets[c + 1] - 1 in input order: text keys
+// each end with '\n', binary keys are record_size bytes each.
+#define INDEX_MAGIC "SPIRIDX1"
+#define INDEX_HEADER_WORDS 3
+#define INDEX_HEADER_BYTES ((INDEX_HEADER_WORDS + SPIRAL_PERIOD + 1) * 8)
+#define INDEX_MIN_SLICE_BYTES (1 << 16)
+#define INDEX_MAX_THREADS 256
+#define INDEX_BLANK_LINE 0xFFFE
+#define INDEX_INVALID_LINE 0xFFFF
+
+static void store_le64(unsigned char* out, unsigned long long value) {
+    for (int i = 0; i < 8; ++i) out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static unsigned long long load_le64(const unsigned char* in) {
+    unsigned long long value = 0;
+    for (int i = 7; i >= 0; --i) value = (value << 8) | in[i];
+    return value;
+}
+
+// One thread's slice of the input. The first pass stores every line's residue
+// and the key bytes it adds to each cell; the second copies the keys to
+// out_pos[cell], this slice's place inside each cell of the index.
+struct index_part {
+    const char* data;
+    size_t len;
+    enum mapper_input_format format;
+    size_t record_size;
+    unsigned short* residues; // Per line: residue, INDEX_BLANK_LINE or INDEX_INVALID_LINE
+    size_t line_count;
+    size_t line_cap;
+    size_t invalid_count;
+    unsigned long long cell_bytes[SPIRAL_PERIOD];
+    unsigned char* out;
+    unsigned long long out_pos[SPIRAL_PERIOD];
+    int pass;
+    int failed;
+};
+
+// Steps *pos past the next line or record of the part and sets *digits/*len to it
+// (without '\n' or "\r\n"). Returns 0 at the end of the part.
+static int index_next_line(const struct index_part* part, size_t* pos, const char** digits, size_t* len) {
+    if (*pos >= part->len) return 0;
+    *digits = part->data + *pos;
+    size_t left = part->len - *pos;
+    if (part->format == MAPPER_INPUT_BINARY) {
+        *len = left < part->record_size ? left : part->record_size;
+        *pos += *len;
+        return 1;
+    }
+    const char* newline = memchr(*digits, '\n', left);
+    *len = newline ? (size_t)(newline - *digits) : left;
+    *pos += *len + 1;
+    if (*len > 0 && (*digits)[*len - 1] == '\r') (*len)--;
+    return 1;
+}
+
+static void index_partition_part(struct index_part* part) {
+    size_t pos = 0;
+    const char* digits;
+    size_t len;
+    if (part->pass == 1) {
+        while (index_next_line(part, &pos, &digits, &len)) {
+            if (grow_buffer((void**)&part->residues, &part->line_cap, part->line_count + 1,
+                            sizeof(*part->residues)) == -1) {
+                part->failed = 1;
+                return;
+            }
+            int residue = len == 0 ? INDEX_BLANK_LINE : format_residue(part->format, part->record_size, digits, len);
+            if (residue == -1) {
+                residue = INDEX_INVALID_LINE;
+                part->invalid_count++;
+            } else if (residue != INDEX_BLANK_LINE) {
+                part->cell_bytes[residue] += part->format == MAPPER_INPUT_BINARY ? len : len + 1;
+            }
+            part->residues[part->line_count++] = (unsigned short)residue;
+        }
+        return;
+    }
+
+    for (size_t line = 0; index_next_line(part, &pos, &digits, &len); ++line) {
+        unsigned short residue = part->residues[line];
+        if (residue >= SPIRAL_PERIOD) continue;
+        unsigned char* out = part->out + part->out_pos[residue];
+        memcpy(out, digits, len);
+        if (part->format != MAPPER_INPUT_BINARY) out[len++] = '\n';
+        part->out_pos[residue] += len;
+    }
+}
+
+static void* index_worker(void* arg) {
+    index_partition_part(arg);
+    return NULL;
+}
+
+// Runs one pass over every part: parts[1..] on new threads, parts[0] and any part
+// whose thread cannot be started on the calling thread.
+static void index_run_pass(struct index_part* parts, size_t part_count, int pass) {
+    pthread_t threads[INDEX_MAX_THREADS];
+    int started[INDEX_MAX_THREADS] = {0};
+    for (size_t t = 0; t < part_count; ++t) parts[t].pass = pass;
+    for (size_t t = 1; t < part_count; ++t) {
+        started[t] = pthread_create(&threads[t], NULL, index_worker, &parts[t]) == 0;
+    }
+    index_partition_part(&parts[0]);
+    for (size_t t = 1; t < part_count; ++t) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            index_partition_part(&parts[t]);
+        }
+    }
+}
+
+// Reports each invalid line of the parts by its line number in the input.
+static void index_report_invalid(const struct index_part* parts, size_t part_count) {
+    unsigned long long line_no = 1;
+    for (size_t t = 0; t < part_count; ++t) {
+        for (size_t i = 0; i < parts[t].line_count && parts[t].invalid_count > 0; ++i) {
+            if (parts[t].residues[i] != INDEX_INVALID_LINE) continue;
+            mapper_report(parts[t].format == MAPPER_INPUT_BINARY ? MAPPER_ERROR_SHORT_RECORD
+                                                                 : MAPPER_ERROR_INVALID_DIGIT,
+                          line_no + i);
+        }
+        line_no += parts[t].line_count;
+    }
+}
+
+// Creates index_path with room for size bytes and maps it for writing. The space
+// is allocated up front so that a full disk fails here rather than with SIGBUS.
+static unsigned char* index_create_file(const char* index_path, size_t size) {
+    int fd = open(index_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return NULL;
+    if (posix_fallocate(fd, 0, (off_t)size) != 0) {
+        close(fd);
+        return NULL;
+    }
+    void* out = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return out == MAP_FAILED ? NULL : out;
+}
+
+int mapper_index_build(const char* data, size_t len, const char* index_path, int num_threads,
+                       enum mapper_input_format format, size_t record_size) {
+    if (!data || !index_path) return -1;
+    if (format == MAPPER_INPUT_BINARY && record_size == 0) return -1;
+    num_threads = default_thread_count(num_threads);
+    size_t part_count = len / INDEX_MIN_SLICE_BYTES;
+    if (part_count > (size_t)num_threads) part_count = (size_t)num_threads;
+    if (part_count > INDEX_MAX_THREADS) part_count = INDEX_MAX_THREADS;
+    if (part_count < 1) part_count = 1;
+
+    struct index_part* parts = calloc(part_count, sizeof(*parts));
+    if (!parts) return -1;
+
+    // Slices end on a line (or record) boundary.
+    size_t start = 0;
+    for (size_t t = 0; t < part_count; ++t) {
+        size_t end = t + 1 == part_count ? len : len / part_count * (t + 1);
+        if (end < start) end = start;
+        if (format == MAPPER_INPUT_BINARY) {
+            end = t + 1 == part_count ? len : end - end % record_size;
+            if (end < start) end = start;
+        } else if (t + 1 < part_count) {
+            const char* newline = end < len ? memchr(data + end, '\n', len - end) : NULL;
+            end = newline ? (size_t)(newline - data) + 1 : len;
+        }
+        parts[t].data = data + start;
+        parts[t].len = end - start;
+        parts[t].format = format;
+        parts[t].record_size = record_size;
+        start = end;
+    }
+
+    int ret = -1;
+    index_run_pass(parts, part_count, 1);
+    size_t invalid = 0;
+    int failed = 0;
+    for (size_t t = 0; t < part_count; ++t) {
+        failed |= parts[t].failed;
+        invalid += parts[t].invalid_count;
+    }
+    if (failed) goto done;
+
+    // Cell c starts after every earlier cell; within it, part t follows parts 0..t-1.
+    unsigned long long offsets[SPIRAL_PERIOD + 1];
+    unsigned long long total = 0;
+    for (int c = 0; c < SPIRAL_PERIOD; ++c) {
+        offsets[c] = total;
+        for (size_t t = 0; t < part_count; ++t) {
+            parts[t].out_pos[c] = INDEX_HEADER_BYTES + total;
+            total += parts[t].cell_bytes[c];
+        }
+    }
+    offsets[SPIRAL_PERIOD] = total;
+
+    size_t size = INDEX_HEADER_BYTES + (size_t)total;
+    unsigned char* out = index_create_file(index_path, size);
+    if (!out) goto done;
+    memcpy(out, INDEX_MAGIC, 8);
+    store_le64(out + 8, format == MAPPER_INPUT_BINARY ? record_size : 0);
+    store_le64(out + 16, SPIRAL_PERIOD);
+    for (int c = 0; c <= SPIRAL_PERIOD; ++c) store_le64(out + (INDEX_HEADER_WORDS + c) * 8, offsets[c]);
+    for (size_t t = 0; t < part_count; ++t) parts[t].out = out;
+    index_run_pass(parts, part_count, 2);
+
+    index_report_invalid(parts, part_count);
+    failed = msync(out, size, MS_SYNC) != 0;
+    failed |= munmap(out, size) != 0;
+    if (!failed) ret = invalid > INT_MAX ? INT_MAX : (int)invalid;
+
+done:
+    for (size_t t = 0; t < part_count; ++t) free(parts[t].residues);
+    free(parts);
+    return ret;
+}
+
+int mapper_index_open(const char* index_path, struct mapper_index* index) {
+    if (!index_path || !index) return -1;
+    size_t size;
+    const char* data = map_whole_file(index_path, &size, MADV_RANDOM);
+    if (!data) return -1;
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    // Offsets must rise monotonically and end exactly at the end of the file.
+    int valid = size >= INDEX_HEADER_BYTES && memcmp(bytes, INDEX_MAGIC, 8) == 0 &&
+                load_le64(bytes + 16) == SPIRAL_PERIOD && load_le64(bytes + 8) <= SIZE_MAX;
+    unsigned long long previous = 0;
+    for (int c = 0; valid && c <= SPIRAL_PERIOD; ++c) {
+        unsigned long long offset = load_le64(bytes + (INDEX_HEADER_WORDS + c) * 8);
+        valid = offset >= previous && offset <= size - INDEX_HEADER_BYTES;
+        previous = offset;
+    }
+    if (!valid || previous != size - INDEX_HEADER_BYTES) {
+        unmap_whole_file(data, size);
+        return -1;
+    }
+    index->data = data;
+    index->size = size;
+    index->record_size = (size_t)load_le64(bytes + 8);
+    return 0;
+}
+
+int mapper_index_cell(const struct mapper_index* index, int theta, int ring, const char** keys_out, size_t* len_out) {
+    if (!index || !index->data || !keys_out || !len_out) return -1;
+    if (theta < 0 || theta >= SPIRAL_ANGULAR_DIVISIONS || ring < 0 || ring >= SPIRAL_RING_COUNT) return -1;
+    int cell = theta + SPIRAL_ANGULAR_DIVISIONS * ring;
+    const unsigned char* offsets = (const unsigned char*)index->data + INDEX_HEADER_WORDS * 8;
+    unsigned long long begin = load_le64(offsets + (size_t)cell * 8);
+    unsigned long long end = load_le64(offsets + (size_t)(cell + 1) * 8);
+    *keys_out = index->data + INDEX_HEADER_BYTES + begin;
+    *len_out = (size_t)(end - begin);
+    return 0;
+}
+
+void mapper_index_close(struct mapper_index* index) {
+    if (!index || !index->data) return;
+    unmap_whole_file(index->data, index->size);
+    index->data = NULL;
+    index->size = 0;
+}
+
+// Mapping service. The loop thread owns every connection. Jobs refer to their
+// connection's buffers by offset, so the buffers may grow while frames are read;
+// nothing touches them while a batch is being mapped.
+#define SERVE_EVENTS 64
+#define SERVE_READ_BYTES (1 << 16)
+#define SERVE_MAX_PENDING (1 << 20) // Queued reply bytes past which a connection is not read
+#define SERVE_PARALLEL_MIN_BYTES (1 << 15) // Smaller batches are mapped on the loop thread
+#define SERVE_CLAIM_JOBS 64
+
+struct serve_conn {
+    int fd;
+    size_t index; // Position in serve_loop.conns
+    unsigned int events; // Current epoll interest
+    int eof; // The peer has shut down its side; close once the replies are out
+    int dead; // Protocol or socket error; close without flushing
+    char* in;
+    size_t in_len;
+    size_t in_cap;
+    size_t in_parsed; // Bytes of in already cut into jobs
+    unsigned char* out;
+    size_t out_len;
+    size_t out_cap;
+    size_t out_sent;
+};
+
+struct serve_job {
+    struct serve_conn* conn;
+    size_t in_offset;
+    size_t len;
+    size_t out_offset;
+};
+
+struct serve_loop {
+    enum mapper_input_format format;
+    int epoll_fd;
+    struct serve_conn** conns;
+    size_t conn_count;
+    size_t conn_cap;
+    struct serve_job* jobs; // The current batch
+    size_t job_count;
+    size_t job_cap;
+    size_t job_bytes;
+    size_t next_job; // Claimed SERVE_CLAIM_JOBS at a time by the mapping threads
+
+    pthread_mutex_t lock;
+    pthread_cond_t start; // A new batch (generation) or stopping
+    pthread_cond_t done; // busy dropped to 0
+    unsigned long long generation;
+    int busy; // Workers still mapping the current batch
+    int stopping;
+    pthread_t* threads;
+    int thread_count;
+};
+
+// epoll tags for the two descriptors that are not connections.
+static char serve_listen_tag;
+static char serve_stop_tag;
+
+static void store_le32(unsigned char* out, unsigned int value) {
+    for (int i = 0; i < 4; ++i) out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static unsigned int load_le32(const unsigned char* in) {
+    return (unsigned int)in[0] | (unsigned int)in[1] << 8 | (unsigned int)in[2] << 16 | (unsigned int)in[3] << 24;
+}
+
+// Maps jobs of the current batch until none are left unclaimed. Run by the loop
+// thread and, for large batches, by every worker at once.
+static void serve_map_jobs(struct serve_loop* loop) {
+    unsigned long long start = stats_ticks();
+    unsigned long long bytes = 0;
+    size_t numbers = 0;
+    for (;;) {
+        size_t first = __atomic_fetch_add(&loop->next_job, SERVE_CLAIM_JOBS, __ATOMIC_RELAXED);
+        if (first >= loop->job_count) break;
+        size_t last = loop->job_count - first < SERVE_CLAIM_JOBS ? loop->job_count : first + SERVE_CLAIM_JOBS;
+        for (size_t i = first; i < last; ++i) {
+            const struct serve_job* job = &loop->jobs[i];
+            struct mapper_cell cell;
+            enum mapper_error error = mapper_core_map(loop->format, job->conn->in + job->in_offset, job->len, &cell);
+            if (error != MAPPER_OK) {
+                memset(&cell, 0, sizeof(cell));
+            } else {
+                numbers++;
+                bytes += job->len;
+            }
+            unsigned int x_bits, y_bits;
+            memcpy(&x_bits, &cell.x, sizeof(x_bits));
+            memcpy(&y_bits, &cell.y, sizeof(y_bits));
+            unsigned char* reply = job->conn->out + job->out_offset;
+            store_le32(reply, (unsigned int)error);
+            store_le32(reply + 4, (unsigned int)cell.theta);
+            store_le32(reply + 8, (unsigned int)cell.ring);
+            store_le32(reply + 12, x_bits);
+            store_le32(reply + 16, y_bits);
+        }
+    }
+    stats_stage(MAPPER_STAGE_REDUCE, stats_ticks() - start);
+    stats_numbers(numbers, bytes);
+}
+
+static void* serve_worker(void* arg) {
+    struct serve_loop* loop = arg;
+    unsigned long long seen = 0;
+    pthread_mutex_lock(&loop->lock);
+    for (;;) {
+        while (!loop->stopping && loop->generation == seen) pthread_cond_wait(&loop->start, &loop->lock);
+        if (loop->stopping) break;
+        seen = loop->generation;
+        pthread_mutex_unlock(&loop->lock);
+        serve_map_jobs(loop);
+        pthread_mutex_lock(&loop->lock);
+        if (--loop->busy == 0) pthread_cond_signal(&loop->done);
+    }
+    pthread_mutex_unlock(&loop->lock);
+    return NULL;
+}
+
+// Maps the current batch, on the pool if it is large enough to repay waking it.
+static void serve_run_batch(struct serve_loop* loop) {
+    if (loop->job_count == 0) return;
+    loop->next_job = 0;
+    if (loop->thread_count == 0 || loop->job_bytes < SERVE_PARALLEL_MIN_BYTES) {
+        serve_map_jobs(loop);
+        return;
+    }
+    pthread_mutex_lock(&loop->lock);
+    loop->busy = loop->thread_count;
+    loop->generation++;
+    pthread_cond_broadcast(&loop->start);
+    pthread_mutex_unlock(&loop->lock);
+    serve_map_jobs(loop);
+    pthread_mutex_lock(&loop->lock);
+    while (loop->busy > 0) pthread_cond_wait(&loop->done, &loop->lock);
+    pthread_mutex_unlock(&loop->lock);
+}
+
+// Reads what conn has sent and cuts every complete frame into a job of the batch,
+// reserving its reply in conn->out.
+static void serve_read(struct serve_loop* loop, struct serve_conn* conn) {
+    if (grow_buffer((void**)&conn->in, &conn->in_cap, conn->in_len + SERVE_READ_BYTES, 1) == -1) {
+        conn->dead = 1;
+        return;
+    }
+    ssize_t got = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+    if (got == 0) {
+        conn->eof = 1;
+        return;
+    }
+    if (got < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) conn->dead = 1;
+        return;
+    }
+    conn->in_len += (size_t)got;
+    while (conn->in_len - conn->in_parsed >= 4) {
+        size_t len = load_le32((const unsigned char*)conn->in + conn->in_parsed);
+        if (len > MAPPER_SERVE_MAX_NUMBER) {
+            conn->dead = 1;
+            return;
+        }
+        if (conn->in_len - conn->in_parsed - 4 < len) break;
+        if (grow_buffer((void**)&loop->jobs, &loop->job_cap, loop->job_count + 1, sizeof(*loop->jobs)) == -1 ||
+            grow_buffer((void**)&conn->out, &conn->out_cap, conn->out_len + MAPPER_SERVE_REPLY_BYTES, 1) == -1) {
+            conn->dead = 1;
+            return;
+        }
+        struct serve_job* job = &loop->jobs[loop->job_count++];
+        job->conn = conn;
+        job->in_offset = conn->in_parsed + 4;
+        job->len = len;
+        job->out_offset = conn->out_len;
+        conn->out_len += MAPPER_SERVE_REPLY_BYTES;
+        conn->in_parsed += 4 + len;
+        loop->job_bytes += len;
+    }
+}
+
+// Sends as much of conn's queued replies as the socket takes without blocking.
+static void serve_flush(struct serve_conn* conn) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t sent = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn->dead = 1;
+            break;
+        }
+        conn->out_sent += (size_t)sent;
+    }
+    if (conn->out_sent == 0) return;
+    memmove(conn->out, conn->out + conn->out_sent, conn->out_len - conn->out_sent);
+    conn->out_len -= conn->out_sent;
+    conn->out_sent = 0;
+}
+
+static void serve_close(struct serve_loop* loop, struct serve_conn* conn) {
+    close(conn->fd);
+    loop->conns[conn->index] = loop->conns[--loop->conn_count];
+    loop->conns[conn->index]->index = conn->index;
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+// After a batch: drops the parsed frames, sends the replies, and closes conn or
+// sets what epoll should watch it for. Reading stops while too many replies wait.
+static void serve_settle(struct serve_loop* loop, struct serve_conn* conn) {
+    if (conn->in_parsed > 0) {
+        memmove(conn->in, conn->in + conn->in_parsed, conn->in_len - conn->in_parsed);
+        conn->in_len -= conn->in_parsed;
+        conn->in_parsed = 0;
+    }
+    if (!conn->dead) serve_flush(conn);
+    if (conn->dead || (conn->eof && conn->out_len == 0)) {
+        serve_close(loop, conn);
+        return;
+    }
+    unsigned int events = (!conn->eof && conn->out_len <= SERVE_MAX_PENDING ? EPOLLIN : 0) |
+                          (conn->out_len > 0 ? EPOLLOUT : 0);
+    if (events != conn->events) {
+        struct epoll_event event = { .events = events, .data.ptr = conn };
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) == -1) {
+            serve_close(loop, conn);
+            return;
+        }
+        conn->events = events;
+    }
+}
+
+// Accepts every pending connection on listen_fd.
+static void serve_accept(struct serve_loop* loop, int listen_fd) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+        struct serve_conn* conn = calloc(1, sizeof(*conn));
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (!conn || fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+            grow_buffer((void**)&loop->conns, &loop->conn_cap, loop->conn_count + 1, sizeof(*loop->conns)) == -1 ||
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        conn->index = loop->conn_count;
+        loop->conns[loop->conn_count++] = conn;
+    }
+}
+
+int mapper_serve(int listen_fd, int stop_fd, int num_threads, enum mapper_input_format format) {
+    if (listen_fd < 0 || stop_fd < 0) return -1;
+    int flags = fcntl(listen_fd, F_GETFL);
+    if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1) return -1;
+    struct serve_loop* loop = calloc(1, sizeof(*loop));
+    if (!loop) return -1;
+    loop->format = format;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = &serve_listen_tag };
+    struct epoll_event stop_event = { .events = EPOLLIN, .data.ptr = &serve_stop_tag };
+    if (loop->epoll_fd == -1 || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) == -1 ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, stop_fd, &stop_event) == -1) {
+        if (loop->epoll_fd != -1) close(loop->epoll_fd);
+        free(loop);
+        return -1;
+    }
+
+    // The loop thread maps too, so the pool has num_threads - 1 workers; any that
+    // cannot be started leave their share to the others.
+    num_threads = default_thread_count(num_threads);
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->start, NULL);
+    pthread_cond_init(&loop->done, NULL);
+    loop->threads = num_threads > 1 ? malloc((size_t)(num_threads - 1) * sizeof(*loop->threads)) : NULL;
+    for (int t = 0; loop->threads && t < num_threads - 1; ++t) {
+        if (pthread_create(&loop->threads[loop->thread_count], NULL, serve_worker, loop) == 0) loop->thread_count++;
+    }
+
+    int ret = 0;
+    struct epoll_event events[SERVE_EVENTS];
+    int stopping = 0;
+    while (!stopping) {
+        int ready = epoll_wait(loop->epoll_fd, events, SERVE_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            ret = -1;
+            break;
+        }
+        loop->job_count = 0;
+        loop->job_bytes = 0;
+        for (int i = 0; i < ready; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == &serve_stop_tag) {
+                stopping = 1;
+            } else if (tag == &serve_listen_tag) {
+                serve_accept(loop, listen_fd);
+            } else {
+                struct serve_conn* conn = tag;
+                if ((conn->events & EPOLLIN) && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    serve_read(loop, conn);
+                }
+            }
+        }
+        serve_run_batch(loop);
+        for (int i = 0; i < ready; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag != &serve_stop_tag && tag != &serve_listen_tag) serve_settle(loop, tag);
+        }
+    }
+
+    pthread_mutex_lock(&loop->lock);
+    loop->stopping = 1;
+    pthread_cond_broadcast(&loop->start);
+    pthread_mutex_unlock(&loop->lock);
+    for (int t = 0; t < loop->thread_count; ++t) pthread_join(loop->threads[t], NULL);
+    while (loop->conn_count > 0) serve_close(loop, loop->conns[loop->conn_count - 1]);
+    pthread_cond_destroy(&loop->done);
+    pthread_cond_destroy(&loop->start);
+    pthread_mutex_destroy(&loop->lock);
+    close(loop->epoll_fd);
+    free(loop->threads);
+    free(loop->conns);
+    free(loop->jobs);
+    free(loop);
+    return ret;
+}
+
+#if !defined(TEST_MAPPER) && !defined(MAPPER_NO_MAIN)
+// Maps the file at path into memory and streams it through map_to_cartesian_buffer
+// (or, with histogram set, counts it through map_to_cartesian_histogram_buffer_geometry,
+// and with gross_radius set, maps it through map_to_cartesian_buffer_gross).
+static int map_file_mmap(const char* path, FILE* out, char separator, int num_threads,
+                         enum mapper_input_format format, size_t record_size, unsigned long long* histogram,
+                         const struct mapper_geometry* geometry, int gross_radius) {
+    size_t len;
+    const char* data = map_whole_file(path, &len, MADV_SEQUENTIAL);
+    if (!data) return -1;
+    int ret;
+    if (histogram) {
+        ret = map_to_cartesian_histogram_buffer_geometry(geometry, data, len, histogram, num_threads, format,
+                                                         record_size);
+    } else if (gross_radius) {
+        ret = map_to_cartesian_buffer_gross(data, len, out, separator, num_threads);
+    } else {
+        ret = map_to_cartesian_buffer_geometry(geometry, data, len, out, separator, num_threads, format, record_size);
+    }
+    unmap_whole_file(data, len);
+    return ret;
+}
+
+// Counts the numbers from stdin (path NULL) or path per cell of geometry and writes
+// their density image to image_path: PGM if its name ends in ".pgm", else PPM.
+// Returns the number of invalid lines, or -1 if the input cannot be read or the
+// image written.
+static int render_file(const char* path, int use_mmap, const char* image_path, int width, int height,
+                       const struct mapper_geometry* geometry, int num_threads, enum mapper_input_format format,
+                       size_t record_size) {
+    unsigned long long* counts = malloc((size_t)geometry->cell_count * sizeof(*counts));
+    if (!counts) return -1;
+    int invalid_lines;
+    if (use_mmap) {
+        invalid_lines = map_file_mmap(path, stdout, ',', num_threads, format, record_size, counts, geometry, 0);
+    } else {
+        FILE* in = path ? fopen(path, "rb") : stdin;
+        invalid_lines = in ? map_to_cartesian_histogram_geometry(geometry, in, counts, num_threads, format,
+                                                                 record_size)
+                           : -1;
+        if (in && in != stdin) fclose(in);
+    }
+    if (invalid_lines != -1) {
+        size_t name_len = strlen(image_path);
+        enum mapper_image_format image_format =
+            name_len >= 4 && strcmp(image_path + name_len - 4, ".pgm") == 0 ? MAPPER_IMAGE_PGM : MAPPER_IMAGE_PPM;
+        FILE* image = fopen(image_path, "wb");
+        int rendered = image ? mapper_render_density(geometry, counts, width, height, image_format, image) : -1;
+        if (image && fclose(image) != 0) rendered = -1;
+        if (rendered == -1) invalid_lines = -1;
+    }
+    free(counts);
+    return invalid_lines;
+}
+
+// Write end of the pipe that stops --serve, written by the SIGINT/SIGTERM handler.
+static int serve_stop_write = -1;
+
+static void serve_stop_signal(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    ssize_t ignored = write(serve_stop_write, "", 1);
+    (void)ignored;
+    errno = saved_errno;
+}
+
+// Opens the listening socket for --serve: TCP for "PORT" or "HOST:PORT", where
+// HOST is localhost or an IPv4 address (an empty HOST or none means 127.0.0.1),
+// and otherwise a Unix socket at the path address. A stale Unix socket left by a
+// previous run is replaced, a live one is not. Sets *is_unix.
+// Returns the socket, or -1.
+static int serve_listen(const char* address, int* is_unix) {
+    const char* colon = strrchr(address, ':');
+    const char* port_str = colon ? colon + 1 : address;
+    char* end;
+    long port = strtol(port_str, &end, 10);
+    *is_unix = strchr(address, '/') || !isdigit((unsigned char)*port_str) || *end != '\0' || port < 1 ||
+               port > 65535;
+    int fd;
+    if (!*is_unix) {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((unsigned short)port) };
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        char host[64];
+        size_t host_len = colon ? (size_t)(colon - address) : 0;
+        if (host_len >= sizeof(host)) return -1;
+        memcpy(host, address, host_len);
+        host[host_len] = '\0';
+        if (host_len > 0 && strcmp(host, "localhost") != 0 && inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+            bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            if (fd != -1) close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(address) >= sizeof(addr.sun_path)) return -1;
+        strcpy(addr.sun_path, address);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) return -1;
+        struct stat st;
+        if (lstat(address, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0) {
+                close(fd);
+                return -1;
+            }
+            unlink(address);
+        }
+        if (bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        if (*is_unix) unlink(address);
+        return -1;
+    }
+    return fd;
+}
+
+// Runs mapper_serve on address until SIGINT or SIGTERM, then removes a Unix socket.
+static int run_server(const char* address, int num_threads, enum mapper_input_format format) {
+    int is_unix;
+    int listen_fd = serve_listen(address, &is_unix);
+    if (listen_fd == -1) {
+        fprintf(stderr, "Error: cannot listen on %s\n", address);
+        return 1;
+    }
+    int stop_pipe[2];
+    if (pipe(stop_pipe) == -1) {
+        fprintf(stderr, "Error: cannot create the stop pipe\n");
+        close(listen_fd);
+        if (is_unix) unlink(address);
+        return 1;
+    }
+    serve_stop_write = stop_pipe[1];
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = serve_stop_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int ret = mapper_serve(listen_fd, stop_pipe[0], num_threads, format);
+    close(listen_fd);
+    if (is_unix) unlink(address);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    if (ret == -1) {
+        fprintf(stderr, "Error: serving %s failed\n", address);
+        return 1;
+    }
+    return 0;
+}
+
+// Maps the single number in path ("-" for stdin) and prints its row without the
+// number itself, which may be far too long to echo.
+static int map_number_file(const char* path, char separator) {
+    FILE* in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return 1;
+    }
+    enum mapper_error error;
+    int residue = spiral_residue_file(in, &error);
+    if (in != stdin) fclose(in);
+    if (residue == -1) {
+        fprintf(stderr, "Error: %s does not hold a single decimal number\n", path);
+        return 1;
+    }
+    printf("theta%cring%cx%cy\n%d%c%d%c%.8f%c%.8f\n", separator, separator, separator,
+           residue % SPIRAL_ANGULAR_DIVISIONS, separator, residue / SPIRAL_ANGULAR_DIVISIONS, separator,
+           spiral_point_table[residue].x, separator, spiral_point_table[residue].y);
+    return 0;
+}
+
+// Maps input_path and writes its cell index to index_path.
+static int build_index_file(const char* input_path, const char* index_path, int num_threads,
+                            enum mapper_input_format format, size_t record_size) {
+    size_t len;
+    const char* data = map_whole_file(input_path, &len, MADV_SEQUENTIAL);
+    if (!data) return -1;
+    int ret = mapper_index_build(data, len, index_path, num_threads, format, record_size);
+    unmap_whole_file(data, len);
+    return ret;
+}
+
+// Prints the keys of one cell of the index at index_path, one per line (binary
+// keys in lowercase hex).
+static int query_index_file(const char* index_path, int theta, int ring) {
+    struct mapper_index index;
+    if (mapper_index_open(index_path, &index) == -1) return -1;
+    const char* keys;
+    size_t len;
+    int ret = mapper_index_cell(&index, theta, ring, &keys, &len);
+    if (ret == 0 && index.record_size == 0) {
+        if (len > 0 && fwrite(keys, 1, len, stdout) != len) ret = -1;
+    } else if (ret == 0) {
+        static const char hex_digits[] = "0123456789abcdef";
+        for (size_t i = 0; i < len; ++i) {
+            unsigned char byte = (unsigned char)keys[i];
+            putchar(hex_digits[byte >> 4]);
+            putchar(hex_digits[byte & 0xF]);
+            if ((i + 1) % index.record_size == 0) putchar('\n');
+        }
+    }
+    mapper_index_close(&index);
+    if (fflush(stdout) != 0 || ferror(stdout)) ret = -1;
+    return ret;
+}
+
+// Returns 1 if first and last are decimal numbers with first <= last, of any size.
+static int valid_range(const char* first, const char* last) {
+    size_t size = strlen(last) + 1;
+    char* difference = malloc(size);
+    int valid = difference && calculate_large_difference_to_string(first, last, difference, size) == 0;
+    free(difference);
+    return valid;
+}
+
+// Prints the k-th integer of first .. last that lands in cell (theta, ring).
+// Returns the exit status: 2 for a bad argument, 1 if there is no such integer.
+static int print_range_key(const char* first, const char* last, const char* theta_str, const char* ring_str,
+                           const char* k_str) {
+    char* end;
+    long theta = strtol(theta_str, &end, 10);
+    int theta_ok = *theta_str != '\0' && *end == '\0' && theta >= 0 && theta < SPIRAL_ANGULAR_DIVISIONS;
+    long ring = strtol(ring_str, &end, 10);
+    int ring_ok = *ring_str != '\0' && *end == '\0' && ring >= 0 && ring < SPIRAL_RING_COUNT;
+    errno = 0;
+    unsigned long long k = strtoull(k_str, &end, 10);
+    int k_ok = isdigit((unsigned char)*k_str) && *end == '\0' && errno == 0;
+    if (!theta_ok || !ring_ok || !k_ok) {
+        fprintf(stderr, "Error: --key needs 0 <= THETA < %d, 0 <= RING < %d and a decimal K < 2^64\n",
+                SPIRAL_ANGULAR_DIVISIONS, SPIRAL_RING_COUNT);
+        return 2;
+    }
+
+    size_t size = strlen(last) + 1;
+    char* key = malloc(size);
+    if (!key) return 1;
+    int ret = map_to_cartesian_range_key(first, last, (int)theta, (int)ring, k, key, size);
+    if (ret == 0) {
+        printf("%s\n", key);
+    } else {
+        fprintf(stderr, "Error: cell (%ld, %ld) has no key %llu in the range\n", theta, ring, k);
+    }
+    free(key);
+    return ret == 0 ? 0 : 1;
+}
+
+// Prints the rows of print_histogram for the integers first .. last, counted
+// from the bounds alone.
+static int print_range_histogram(const char* first, const char* last, char separator) {
+    static unsigned char extra[MAPPER_CELL_COUNT];
+    size_t size = strlen(last) + 22;
+    char* base = malloc(size);
+    char* base_plus_one = malloc(size);
+    int ret = -1;
+    if (base && base_plus_one && map_to_cartesian_range_counts(first, last, base, size, extra) == 0 &&
+        calculate_large_add_to_string(base, 1, base_plus_one, size) == 0) {
+        printf("theta%cring%cx%cy%ccount\n", separator, separator, separator, separator);
+        for (int r = 0; r < SPIRAL_PERIOD; ++r) {
+            printf("%d%c%d%c%.8f%c%.8f%c%s\n", r % SPIRAL_ANGULAR_DIVISIONS, separator, r / SPIRAL_ANGULAR_DIVISIONS,
+                   separator, spiral_point_table[r].x, separator, spiral_point_table[r].y, separator,
+                   extra[r] ? base_plus_one : base);
+        }
+        ret = fflush(stdout) == 0 && !ferror(stdout) ? 0 : -1;
+    }
+    free(base);
+    free(base_plus_one);
+    return ret;
+}
+
+// Prints one row per cell with its hit count, in residue order (theta varies fastest).
+static int print_histogram(const unsigned long long* counts, char separator) {
+    printf("theta%cring%cx%cy%ccount\n", separator, separator, separator, separator);
+    for (int r = 0; r < SPIRAL_PERIOD; ++r) {
+        printf("%d%c%d%c%.8f%c%.8f%c%llu\n", r % SPIRAL_ANGULAR_DIVISIONS, separator, r / SPIRAL_ANGULAR_DIVISIONS,
+               separator, spiral_point_table[r].x, separator, spiral_point_table[r].y, separator, counts[r]);
+    }
+    return fflush(stdout) == 0 && !ferror(stdout) ? 0 : -1;
+}
+
+static void print_usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s                    map the built-in example number\n"
+            "       %s --stdin [options]  map one number per line from standard input\n"
+            "       %s -f FILE [options]  map one number per line from FILE\n"
+            "       %s --mmap FILE [options]  same, memory-mapping FILE instead of reading it\n"
+            "       %s --range A B [options]  map every integer from A to B inclusive\n"
+            "       %s --number FILE [options]  map the one number in FILE (- for stdin), read in blocks\n"
+            "       %s -f FILE --build-index OUT [options]  write the keys of FILE grouped by cell to OUT\n"
+            "       %s --query INDEX THETA RING  print the keys of one cell of an index\n"
+            "       %s --serve ADDRESS [options]  answer mapping requests on a Unix socket path,\n"
+            "                     or on TCP for PORT or HOST:PORT, until SIGINT or SIGTERM\n"
+            "Options:\n"
+            "  --format csv|tsv   output format (default csv)\n"
+            "  --input dec|hex|bin  input numbers: decimal or hex lines, or binary records (default dec)\n"
+            "  --record-size N    bytes per big-endian binary record (default 32)\n"
+            "  --histogram        print hit counts per cell instead of one row per number\n"
+            "                     (with --range, computed from A and B without enumerating)\n"
+            "  --key THETA RING K with --range, print the K-th (from 0) integer landing in that cell\n"
+            "  --render OUT       write a density image of the numbers from --stdin, -f or --mmap\n"
+            "                     to OUT instead of rows: PGM if OUT ends in .pgm, else PPM\n"
+            "  --size WxH         image size for --render (default 1024x1024)\n"
+            "  --angles A --rings R --radius-offset F\n"
+            "                     spiral geometry for rows from --stdin, -f, --mmap or --range\n"
+            "                     (default 40, 77, 1)\n"
+            "  --gross-radius     rows from --stdin, -f or --mmap use the radius N / 40 itself:\n"
+            "                     number,theta,radius,log10_radius,x,y\n"
+            "  --threads N        worker threads (default: one per CPU)\n"
+            "  --stats            print time per stage, input lengths and failures to stderr\n"
+            "                     (mapper built with -DMAPPER_STATS)\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog);
+}
+
+// Prints mapper_stats_get to stderr; registered with atexit by --stats, so it runs
+// on every way out of main.
+static void print_stats(void) {
+    struct mapper_stats stats;
+    if (mapper_stats_get(&stats) == -1) return;
+    unsigned long long failures = 0;
+    for (int e = 0; e < MAPPER_ERROR_KINDS; ++e) failures += stats.errors[e];
+    fprintf(stderr, "Stats: %llu numbers, %llu bytes, %llu failures", stats.numbers, stats.bytes, failures);
+    if (stats.wall_ns > 0) {
+        double seconds = (double)stats.wall_ns / 1e9;
+        fprintf(stderr, " in %.3f s: %.0f numbers/s, %.1f MB/s", seconds, (double)stats.numbers / seconds,
+                (double)stats.bytes / seconds / 1e6);
+    }
+    fprintf(stderr, "\n");
+
+    unsigned long long total_ticks = 0;
+    for (int s = 0; s < MAPPER_STAGE_COUNT; ++s) total_ticks += stats.stage_ticks[s];
+    if (total_ticks > 0) {
+        fprintf(stderr, "Stage     ticks (all threads)   share  ticks/number\n");
+        for (int s = 0; s < MAPPER_STAGE_COUNT; ++s) {
+            if (stats.stage_ticks[s] == 0) continue;
+            fprintf(stderr, "%-8s  %20llu  %5.1f%%  %12.1f\n", mapper_stage_name((enum mapper_stage)s),
+                    stats.stage_ticks[s], 100.0 * (double)stats.stage_ticks[s] / (double)total_ticks,
+                    stats.numbers > 0 ? (double)stats.stage_ticks[s] / (double)stats.numbers : 0.0);
+        }
+        if (stats.ticks_per_second > 0) {
+            fprintf(stderr, "Ticks: %.3f GHz, %.3f s of thread time\n", stats.ticks_per_second / 1e9,
+                    (double)total_ticks / stats.ticks_per_second);
+        }
+    }
+    for (int b = 0; b < MAPPER_STATS_LENGTH_BUCKETS; ++b) {
+        if (stats.lengths[b] == 0) continue;
+        if (b == 0) {
+            fprintf(stderr, "Length 1 byte: %llu\n", stats.lengths[b]);
+        } else if (b + 1 == MAPPER_STATS_LENGTH_BUCKETS) {
+            fprintf(stderr, "Length %llu+ bytes: %llu\n", 1ULL << b, stats.lengths[b]);
+        } else {
+            fprintf(stderr, "Length %llu-%llu bytes: %llu\n", 1ULL << b, (2ULL << b) - 1, stats.lengths[b]);
+        }
+    }
+    for (int e = 0; e < MAPPER_ERROR_KINDS; ++e) {
+        if (stats.errors[e] > 0) {
+            fprintf(stderr, "Failure %s: %llu\n", mapper_error_string((enum mapper_error)e), stats.errors[e]);
+        }
+    }
+}
+
+static int run_example(void);
+
+// Main function (from mapper.c)
+int main(int argc, char** argv) {
+    const char* input_path = NULL;
+    int use_stdin = 0;
+    int use_mmap = 0;
+    const char* range_first = NULL;
+    const char* range_last = NULL;
+    const char* number_path = NULL;
+    char separator = ',';
+    int num_threads = 0;
+    enum mapper_input_format input_format = MAPPER_INPUT_DECIMAL;
+    size_t record_size = 32;
+    int histogram = 0;
+    const char* index_out = NULL;
+    const char* query_index = NULL;
+    const char* query_theta = NULL;
+    const char* query_ring = NULL;
+    const char* key_theta = NULL;
+    const char* key_ring = NULL;
+    const char* key_index = NULL;
+    int angles = SPIRAL_ANGULAR_DIVISIONS;
+    int rings = SPIRAL_RING_COUNT;
+    float radius_offset = 1.0f;
+    int geometry_given = 0;
+    int gross_radius = 0;
+    int stats = 0;
+    const char* render_path = NULL;
+    int render_width = 1024;
+    int render_height = 1024;
+    int size_given = 0;
+    const char* serve_address = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--stdin") == 0) {
+            use_stdin = 1;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (strcmp(argv[i], "--range") == 0 && i + 2 < argc) {
+            range_first = argv[++i];
+            range_last = argv[++i];
+        } else if (strcmp(argv[i], "--number") == 0 && i + 1 < argc) {
+            number_path = argv[++i];
+        } else if (strcmp(argv[i], "--mmap") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+            use_mmap = 1;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char* format = argv[++i];
+            if (strcmp(format, "csv") == 0) {
+                separator = ',';
+            } else if (strcmp(format, "tsv") == 0) {
+                separator = '\t';
+            } else {
+                fprintf(stderr, "Error: unknown format '%s'\n", format);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--build-index") == 0 && i + 1 < argc) {
+            index_out = argv[++i];
+        } else if (strcmp(argv[i], "--query") == 0 && i + 3 < argc) {
+            query_index = argv[++i];
+            query_theta = argv[++i];
+            query_ring = argv[++i];
+        } else if (strcmp(argv[i], "--key") == 0 && i + 3 < argc) {
+            key_theta = argv[++i];
+            key_ring = argv[++i];
+            key_index = argv[++i];
+        } else if ((strcmp(argv[i], "--angles") == 0 || strcmp(argv[i], "--rings") == 0) && i + 1 < argc) {
+            const char* option = argv[i];
+            const char* value = argv[++i];
+            char* end;
+            long count = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || count < 1 || count > INT_MAX) {
+                fprintf(stderr, "Error: %s expects a positive number, not '%s'\n", option, value);
+                return 2;
+            }
+            if (strcmp(option, "--angles") == 0) {
+                angles = (int)count;
+            } else {
+                rings = (int)count;
+            }
+            geometry_given = 1;
+        } else if (strcmp(argv[i], "--radius-offset") == 0 && i + 1 < argc) {
+            const char* value = argv[++i];
+            char* end;
+            radius_offset = strtof(value, &end);
+            if (*value == '\0' || *end != '\0') {
+                fprintf(stderr, "Error: --radius-offset expects a number, not '%s'\n", value);
+                return 2;
+            }
+            geometry_given = 1;
+        } else if (strcmp(argv[i], "--histogram") == 0) {
+            histogram = 1;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_address = argv[++i];
+        } else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+            render_path = argv[++i];
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            char rest;
+            if (sscanf(argv[++i], "%dx%d%c", &render_width, &render_height, &rest) != 2 || render_width < 1 ||
+                render_height < 1 || render_width > MAPPER_RENDER_MAX_SIDE || render_height > MAPPER_RENDER_MAX_SIDE) {
+                fprintf(stderr, "Error: --size expects WxH with sides from 1 to %d\n", MAPPER_RENDER_MAX_SIDE);
+                return 2;
+            }
+            size_given = 1;
+        } else if (strcmp(argv[i], "--gross-radius") == 0) {
+            gross_radius = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            const char* input = argv[++i];
+            if (strcmp(input, "dec") == 0) {
+                input_format = MAPPER_INPUT_DECIMAL;
+            } else if (strcmp(input, "hex") == 0) {
+                input_format = MAPPER_INPUT_HEX;
+            } else if (strcmp(input, "bin") == 0) {
+                input_format = MAPPER_INPUT_BINARY;
+            } else {
+                fprintf(stderr, "Error: unknown input '%s'\n", input);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--record-size") == 0 && i + 1 < argc) {
+            const char* value = argv[++i];
+            char* end;
+            errno = 0;
+            long size = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || errno == ERANGE || size < 1) {
+                fprintf(stderr, "Error: --record-size expects a positive number, not '%s'\n", value);
+                return 2;
+            }
+            record_size = (size_t)size;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            const char* value = argv[++i];
+            char* end;
+            long threads = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || threads < 1 || threads > INT_MAX) {
+                fprintf(stderr, "Error: --threads expects a positive number, not '%s'\n", value);
+                return 2;
+            }
+            num_threads = (int)threads;
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((use_stdin + (input_path != NULL) + (range_first != NULL) + (number_path != NULL)) > 1) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (stats) {
+        struct mapper_stats probe;
+        if (mapper_stats_get(&probe) == -1) {
+            fprintf(stderr, "Error: --stats needs mapper built with -DMAPPER_STATS\n");
+            return 2;
+        }
+        atexit(print_stats);
+    }
+    if (serve_address) {
+        if (use_stdin || input_path || range_first || number_path || histogram || render_path || size_given ||
+            index_out || query_index || key_index || gross_radius || geometry_given) {
+            fprintf(stderr, "Error: --serve takes only --input, --threads and --stats\n");
+            return 2;
+        }
+        return run_server(serve_address, num_threads, input_format);
+    }
+    if ((range_first || number_path) && input_format != MAPPER_INPUT_DECIMAL) {
+        fprintf(stderr, "Error: --range and --number take decimal numbers\n");
+        return 2;
+    }
+    if (render_path || size_given) {
+        if (!render_path || histogram || gross_radius || index_out || query_index || key_index ||
+            (!use_stdin && !input_path)) {
+            fprintf(stderr, "Error: --render (and --size) apply to numbers from --stdin, -f or --mmap\n");
+            return 2;
+        }
+    }
+    if (gross_radius && (histogram || index_out || query_index || range_first || number_path || geometry_given ||
+                         input_format != MAPPER_INPUT_DECIMAL || (!use_stdin && !input_path))) {
+        fprintf(stderr, "Error: --gross-radius applies to decimal rows from --stdin, -f or --mmap\n");
+        return 2;
+    }
+    static struct mapper_geometry geometry;
+    if (geometry_given) {
+        if (histogram || index_out || query_index || key_index || number_path ||
+            (!use_stdin && !input_path && !range_first)) {
+            fprintf(stderr, "Error: --angles, --rings and --radius-offset apply to rows from --stdin, -f, --mmap or --range\n");
+            return 2;
+        }
+        if (mapper_geometry_init(&geometry, angles, rings, radius_offset) == -1) {
+            fprintf(stderr, "Error: geometry needs A, R >= 1, A * R <= %d and |F| <= %d\n", MAPPER_GEOMETRY_MAX_CELLS,
+                    MAPPER_GEOMETRY_MAX_CELLS);
+            return 2;
+        }
+    } else {
+        mapper_geometry_init(&geometry, SPIRAL_ANGULAR_DIVISIONS, SPIRAL_RING_COUNT, 1.0f);
+    }
+    if (query_index) {
+        if (use_stdin || input_path || range_first || number_path || index_out || histogram) {
+            print_usage(argv[0]);
+            return 2;
+        }
+        char* end;
+        long theta = strtol(query_theta, &end, 10);
+        int theta_ok = *query_theta != '\0' && *end == '\0' && theta >= 0 && theta < SPIRAL_ANGULAR_DIVISIONS;
+        long ring = strtol(query_ring, &end, 10);
+        int ring_ok = *query_ring != '\0' && *end == '\0' && ring >= 0 && ring < SPIRAL_RING_COUNT;
+        if (!theta_ok || !ring_ok) {
+            fprintf(stderr, "Error: --query needs 0 <= THETA < %d and 0 <= RING < %d\n", SPIRAL_ANGULAR_DIVISIONS,
+                    SPIRAL_RING_COUNT);
+            return 2;
+        }
+        if (query_index_file(query_index, (int)theta, (int)ring) == -1) {
+            fprintf(stderr, "Error: cannot read index %s or write output\n", query_index);
+            return 1;
+        }
+        return 0;
+    }
+    if (index_out) {
+        if (!input_path || histogram) {
+            fprintf(stderr, "Error: --build-index needs -f or --mmap and no --histogram\n");
+            return 2;
+        }
+        int invalid_lines = build_index_file(input_path, index_out, num_threads, input_format, record_size);
+        if (invalid_lines == -1) {
+            fprintf(stderr, "Error: failed to map %s or write %s\n", input_path, index_out);
+            return 1;
+        }
+        return invalid_lines > 0 ? 1 : 0;
+    }
+    if (histogram && !use_stdin && !input_path && !range_first) {
+        fprintf(stderr, "Error: --histogram needs --stdin, -f, --mmap or --range\n");
+        return 2;
+    }
+    if (key_index && (!range_first || histogram)) {
+        fprintf(stderr, "Error: --key needs --range and no --histogram\n");
+        return 2;
+    }
+    if (range_first && (histogram || key_index)) {
+        if (!valid_range(range_first, range_last)) {
+            fprintf(stderr, "Error: --range needs decimal A <= B\n");
+            return 2;
+        }
+        if (histogram) {
+            if (print_range_histogram(range_first, range_last, separator) == -1) {
+                fprintf(stderr, "Error: failed to write output\n");
+                return 1;
+            }
+            return 0;
+        }
+        return print_range_key(range_first, range_last, key_theta, key_ring, key_index);
+    }
+    if (range_first) {
+        unsigned long long last_offset;
+        if (calculate_large_difference(range_first, range_last, &last_offset) == -1) {
+            fprintf(stderr, "Error: --range needs decimal A <= B with B - A < 2^64\n");
+            return 2;
+        }
+        if (map_to_cartesian_range_stream_geometry(&geometry, range_first, range_last, stdout, separator,
+                                                   num_threads) == -1) {
+            fprintf(stderr, "Error: failed to write output\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (number_path) return map_number_file(number_path, separator);
+    if (!use_stdin && !input_path) return run_example();
+    if (render_path) {
+        int invalid_lines = render_file(input_path, use_mmap, render_path, render_width, render_height, &geometry,
+                                        num_threads, input_format, record_size);
+        if (invalid_lines == -1) {
+            fprintf(stderr, "Error: failed to read input or write %s\n", render_path);
+            return 1;
+        }
+        return invalid_lines > 0 ? 1 : 0;
+    }
+
+    static unsigned long long counts[MAPPER_CELL_COUNT];
+    unsigned long long* histogram_counts = histogram ? counts : NULL;
+    if (use_mmap) {
+        int invalid_lines = map_file_mmap(input_path, stdout, separator, num_threads, input_format, record_size,
+                                          histogram_counts, &geometry, gross_radius);
+        if (invalid_lines == -1 || (histogram && print_histogram(counts, separator) != 0)) {
+            fprintf(stderr, "Error: failed to map %s or write output\n", input_path);
+            return 1;
+        }
+        return invalid_lines > 0 ? 1 : 0;
+    }
+
+    FILE* in = stdin;
+    if (input_path) {
+        in = fopen(input_path, "rb");
+        if (!in) {
+            fprintf(stderr, "Error: cannot open %s\n", input_path);
+            return 1;
+        }
+    }
+    int invalid_lines;
+    if (histogram) {
+        invalid_lines = map_to_cartesian_histogram(in, counts, num_threads, input_format, record_size);
+    } else if (gross_radius) {
+        invalid_lines = map_to_cartesian_stream_gross(in, stdout, separator, num_threads);
+    } else {
+        invalid_lines = map_to_cartesian_stream_geometry(&geometry, in, stdout, separator, num_threads, input_format,
+                                                         record_size);
+    }
+    if (in != stdin) fclose(in);
+
+    if (invalid_lines == -1 || (histogram && print_histogram(counts, separator) != 0)) {
+        fprintf(stderr, "Error: failed to read input or write output\n");
+        return 1;
+    }
+    return invalid_lines > 0 ? 1 : 0;
+}
+
+// Maps the built-in example number and prints the intermediate values.
+static int run_example(void) {
+    const char* large_num_input = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
+    float x_coord, y_coord;
+
+    printf("Attempting to map large number: %s\n", large_num_input);
+
+    int status = map_to_cartesian(large_num_input, &x_coord, &y_coord);
+
+    if (status == 0) {
+        printf("Main: map_to_cartesian successful.\n");
+        printf("Main: Input Number String: %s\n", large_num_input);
+
+        // Parsed once: theta, the gross radius and its ring index all come from the
+        // limbs, and the gross radius is formatted only to print it.
+        struct large_int number = LARGE_INT_INIT;
+        struct large_int gross_radius = LARGE_INT_INIT;
+        int parsed = large_int_from_string(&number, large_num_input);
+
+        int theta_main = parsed == 0 ? calculate_large_div_int(&number, 40, &gross_radius) : -1;
+        printf("Main: Theta Index (from calculate_large_div_int): %d\n", theta_main);
+        if (theta_main != -1) {
+             printf("Main: Angle (degrees): %d\n", theta_main * 9);
+             if (theta_main >= 0 && theta_main < 40) {
+                printf("Main: Cos_val from table at index %d: %.8f\n", theta_main, cos_table[theta_main]);
+                printf("Main: Sin_val from table at index %d: %.8f\n", theta_main, sin_table[theta_main]);
+            } else {
+                printf("Main: Theta index %d is out of bounds for table lookup.\n", theta_main);
+            }
+        } else {
+            printf("Main: Error calculating theta_index for verification.\n");
+        }
+
+        size_t gross_radius_buf_size = large_int_string_size(&gross_radius);
+        char* gross_radius_str_main = malloc(gross_radius_buf_size);
+
+        if (theta_main != -1 && gross_radius_str_main &&
+            large_int_to_string(&gross_radius, gross_radius_str_main, gross_radius_buf_size) == 0) {
+            printf("Main: Gross Radius String (calculated in main): %s\n", gross_radius_str_main);
+
+            float gross_radius_as_float = strtof(gross_radius_str_main, NULL);
+            printf("Main: Gross Radius String '%s' as float (strtof): %f (scientific: %e)\n",
+                   gross_radius_str_main, gross_radius_as_float, gross_radius_as_float);
+
+            double gross_radius_double, gross_radius_log10;
+            if (calculate_large_div_to_double(large_num_input, 40, &gross_radius_double, &gross_radius_log10) == 0) {
+                printf("Main: Gross Radius as double (from the leading digits): %.17g (log10: %.8f)\n",
+                       gross_radius_double, gross_radius_log10);
+            }
+
+            int indice_circunferencia_main = calculate_large_mod_int(&gross_radius, 77);
+            if (indice_circunferencia_main != -1) {
+                printf("Main: Indice da Circunferencia (calculated in main from gross radius string): %d\n", indice_circunferencia_main);
+                float R_efetivo_main = (float)indice_circunferencia_main + 1.0f;
+                printf("Main: R_efetivo (calculated in main): %.8f\n", R_efetivo_main);
+            } else {
+                printf("Main: Error calculating Indice da Circunferencia for verification.\n");
+            }
+        } else {
+            printf("Main: Error calculating Gross Radius String for verification.\n");
+        }
+        free(gross_radius_str_main);
+        large_int_free(&number);
+        large_int_free(&gross_radius);
+
+        printf("Main: X Coordinate (from map_to_cartesian with R_efetivo): %.8f\n", x_coord);
+        printf("Main: Y Coordinate (from map_to_cartesian with R_efetivo): %.8f\n", y_coord);
+    } else {
+        printf("Main: map_to_cartesian failed with status %d. Check stderr for details from the function.\n", status);
+    }
+
+    return status;
+}
+#endif // !TEST_MAPPER && !MAPPER_NO_MAIN
+
+#ifdef TEST_MAPPER
+// Reference mapping through the string arithmetic: N % 40, then (N / 40) % 77.
+static int reference_map(const char* number_str, float *x_out, float *y_out) {
+    size_t radius_buf_size = strlen(number_str) + 2;
+    char radius_buffer[radius_buf_size];
+
+    int theta_index = calculate_large_mod(number_str, 40);
+    if (theta_index == -1) return -1;
+    if (calculate_large_div_to_string(number_str, 40, radius_buffer, radius_buf_size) == -1) return -1;
+    int indice_circunferencia = calculate_large_mod(radius_buffer, 77);
+    if (indice_circunferencia == -1) return -1;
+
+    float R_efetivo = (float)indice_circunferencia + 1.0f;
+    *x_out = R_efetivo * cos_table[theta_index];
+    *y_out = R_efetivo * sin_table[theta_index];
+    return 0;
+}
+
+static int check_against_reference(const char* number_str) {
+    float x = 0.0f, y = 0.0f, ref_x = 0.0f, ref_y = 0.0f;
+    int ret = map_to_cartesian(number_str, &x, &y);
+    int ref_ret = reference_map(number_str, &ref_x, &ref_y);
+    if (ret != ref_ret) return 0;
+    if (ret != 0) return 1;
+    return memcmp(&x, &ref_x, sizeof(x)) == 0 && memcmp(&y, &ref_y, sizeof(y)) == 0;
+}
+
+// Test map_to_cartesian against the reference arithmetic path
+static int test_map_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    char num_buf[64];
+
+    printf("--- Testing map_to_cartesian ---\n");
+
+    // Every residue of the spiral period, both bare and shifted by a large prefix
+    int residues_ok = 1;
+    for (int r = 0; r < 2 * SPIRAL_PERIOD; ++r) {
+        snprintf(num_buf, sizeof(num_buf), "%d", r);
+        if (!check_against_reference(num_buf)) residues_ok = 0;
+        snprintf(num_buf, sizeof(num_buf), "92108364944471082700%04d", r);
+        if (!check_against_reference(num_buf)) residues_ok = 0;
+    }
+    total_tests++;
+    if (residues_ok) {
+        printf("[PASS] Bit-identical coordinates for residues 0..%d\n", 2 * SPIRAL_PERIOD - 1);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Coordinates differ from reference for some residue\n");
+    }
+
+    struct map_test_case {
+        const char* num_str;
+        int expected_ret;
+        float expected_x;
+        float expected_y;
+        const char* desc;
+    } map_cases[] = {
+        {"9210836494447108270027136741376870869791784014198948301625976867708124077590", 0, 0.0f, -57.0f, "76-digit key"},
+        {"0", 0, 1.0f, 0.0f, "Zero input"},
+        {"000123", 0, 4.0f * cos_table[3], 4.0f * sin_table[3], "Leading zeros"},
+        {"", -1, 0.0f, 0.0f, "Empty input string"},
+        {"12a3", -1, 0.0f, 0.0f, "Non-digit in string"},
+        {"-40", -1, 0.0f, 0.0f, "Sign is not a digit"},
+    };
+
+    int num_cases = sizeof(map_cases) / sizeof(map_cases[0]);
+    for (int i = 0; i < num_cases; ++i) {
+        float x = 0.0f, y = 0.0f;
+        int ret = map_to_cartesian(map_cases[i].num_str, &x, &y);
+        int pass = (ret == map_cases[i].expected_ret) &&
+                   (ret != 0 || (x == map_cases[i].expected_x && y == map_cases[i].expected_y)) &&
+                   check_against_reference(map_cases[i].num_str);
+        total_tests++;
+        if (pass) {
+            printf("[PASS] Test: %s -> Ret: %d, X: %.8f, Y: %.8f\n", map_cases[i].desc, ret, x, y);
+            tests_passed++;
+        } else {
+            printf("[FAIL] Test: %s -> Expected Ret: %d, Got Ret: %d, X: %.8f, Y: %.8f\n",
+                   map_cases[i].desc, map_cases[i].expected_ret, ret, x, y);
+        }
+    }
+
+    float x, y;
+    total_tests++;
+    if (map_to_cartesian(NULL, &x, &y) == -1) {
+        printf("[PASS] Test: NULL input string -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: NULL input string -> Expected Ret: -1\n");
+    }
+
+    printf("--- map_to_cartesian tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Test map_to_cartesian_batch and map_to_cartesian_batch_concat against map_to_cartesian
+static int test_batch_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    const size_t count = 50000;
+    const size_t key_width = 24;
+
+    printf("--- Testing map_to_cartesian_batch ---\n");
+
+    char* keys = malloc(count * key_width);
+    const char** key_ptrs = malloc(count * sizeof(*key_ptrs));
+    size_t* offsets = malloc((count + 1) * sizeof(*offsets));
+    char* concat = malloc(count * key_width);
+    float* x = malloc(count * sizeof(*x));
+    float* y = malloc(count * sizeof(*y));
+    int* status = malloc(count * sizeof(*status));
+    if (!keys || !key_ptrs || !offsets || !concat || !x || !y || !status) {
+        printf("[FAIL] Could not allocate test buffers\n");
+        return 0;
+    }
+
+    // Keys of varying length; every 1000th one is malformed.
+    size_t concat_len = 0;
+    size_t expected_failures = 0;
+    for (size_t i = 0; i < count; ++i) {
+        char* key = keys + i * key_width;
+        if (i % 1000 == 999) {
+            snprintf(key, key_width, "%zux", i);
+            expected_failures++;
+        } else {
+            snprintf(key, key_width, "%zu", i * 2654435761u + i % 7);
+        }
+        key_ptrs[i] = key;
+        offsets[i] = concat_len;
+        memcpy(concat + concat_len, key, strlen(key));
+        concat_len += strlen(key);
+    }
+    offsets[count] = concat_len;
+
+    int thread_counts[] = {1, 3, 0};
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t) {
+        for (int use_concat = 0; use_concat <= 1; ++use_concat) {
+            int failures = use_concat
+                ? map_to_cartesian_batch_concat(concat, offsets, count, x, y, status, thread_counts[t])
+                : map_to_cartesian_batch(key_ptrs, count, x, y, status, thread_counts[t]);
+
+            int pass = (failures == (int)expected_failures);
+            for (size_t i = 0; i < count && pass; ++i) {
+                float ref_x = 0.0f, ref_y = 0.0f;
+                int ref_ret = (i % 1000 == 999) ? -1 : 0;
+                if (ref_ret == 0) map_to_cartesian(key_ptrs[i], &ref_x, &ref_y);
+                if (status[i] != ref_ret || x[i] != ref_x || y[i] != ref_y) pass = 0;
+            }
+
+            total_tests++;
+            if (pass) {
+                printf("[PASS] Test: %s, %d threads -> %d failures\n",
+                       use_concat ? "concat buffer" : "string array", thread_counts[t], failures);
+                tests_passed++;
+            } else {
+                printf("[FAIL] Test: %s, %d threads -> Expected %zu failures, Got %d\n",
+                       use_concat ? "concat buffer" : "string array", thread_counts[t], expected_failures, failures);
+            }
+        }
+    }
+
+    const char* edge_keys[] = {"123", NULL, ""};
+    total_tests++;
+    if (map_to_cartesian_batch(edge_keys, 3, x, y, status, 2) == 2 &&
+        status[0] == 0 && status[1] == -1 && status[2] == -1) {
+        printf("[PASS] Test: NULL and empty entries -> status -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: NULL and empty entries -> Expected status -1\n");
+    }
+
+    total_tests++;
+    if (map_to_cartesian_batch(key_ptrs, count, NULL, y, status, 1) == -1 &&
+        map_to_cartesian_batch_concat(concat, NULL, count, x, y, status, 1) == -1) {
+        printf("[PASS] Test: NULL arrays -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: NULL arrays -> Expected Ret: -1\n");
+    }
+
+    free(keys);
+    free(key_ptrs);
+    free(offsets);
+    free(concat);
+    free(x);
+    free(y);
+    free(status);
+
+    printf("--- map_to_cartesian_batch tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Writes content to a temporary file and maps it with map_to_cartesian_file.
+static int map_file_content(const char* content, size_t len, float* x, float* y) {
+    FILE* in = tmpfile();
+    if (!in) return -2;
+    fwrite(content, 1, len, in);
+    rewind(in);
+    int ret = map_to_cartesian_file(in, x, y);
+    fclose(in);
+    return ret;
+}
+
+// Test map_to_cartesian_file on numbers spanning several read blocks
+static int test_file_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    size_t len = 3 * MAPPER_READ_BLOCK + 5;
+    char* content = malloc(len + 3);
+
+    printf("--- Testing map_to_cartesian_file ---\n");
+    if (!content) {
+        printf("[FAIL] Could not allocate test buffer\n");
+        return 0;
+    }
+    for (size_t i = 0; i < len; ++i) content[i] = (char)('0' + (i * 7 + i / 3) % 10);
+    content[len] = '\0';
+    float ex, ey, x, y;
+
+    // Terminators placed so that "\r\n" straddles a block boundary as well
+    const char* endings[] = { "", "\n", "\r\n" };
+    const size_t cut_lengths[] = { len, MAPPER_READ_BLOCK - 1, MAPPER_READ_BLOCK };
+    int file_ok = 1;
+    for (size_t c = 0; c < sizeof(cut_lengths) / sizeof(cut_lengths[0]); ++c) {
+        char saved = content[cut_lengths[c]];
+        content[cut_lengths[c]] = '\0';
+        map_to_cartesian(content, &ex, &ey);
+        content[cut_lengths[c]] = saved;
+        for (size_t e = 0; e < sizeof(endings) / sizeof(endings[0]); ++e) {
+            char* copy = malloc(cut_lengths[c] + 3);
+            if (!copy) {
+                file_ok = 0;
+                break;
+            }
+            memcpy(copy, content, cut_lengths[c]);
+            memcpy(copy + cut_lengths[c], endings[e], strlen(endings[e]));
+            if (map_file_content(copy, cut_lengths[c] + strlen(endings[e]), &x, &y) != 0 || x != ex || y != ey) {
+                file_ok = 0;
+            }
+            free(copy);
+        }
+    }
+    total_tests++;
+    if (file_ok) {
+        printf("[PASS] Test: Multi-block numbers with \"\", \"\\n\", \"\\r\\n\" endings -> same as map_to_cartesian\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Multi-block numbers differ from map_to_cartesian\n");
+    }
+
+    content[MAPPER_READ_BLOCK + 10] = '\n';
+    int inner_newline = map_file_content(content, len, &x, &y);
+    total_tests++;
+    if (inner_newline == -1 && map_file_content("", 0, &x, &y) == -1 &&
+        map_file_content("12\n\n", 4, &x, &y) == -1 && map_file_content("\n", 1, &x, &y) == -1 &&
+        map_file_content("1 2", 3, &x, &y) == -1 && map_to_cartesian_file(NULL, &x, &y) == -1) {
+        printf("[PASS] Test: Inner newline, empty, extra newline, space, NULL -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Invalid file contents -> Expected Ret: -1\n");
+    }
+    free(content);
+
+    printf("--- map_to_cartesian_file tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Runs the streaming pipeline over input in the given format and stores its output in out_buf.
+static int run_stream_format(const char* input, size_t input_len, enum mapper_input_format format,
+                             size_t record_size, char separator, int num_threads, char* out_buf, size_t out_size) {
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    if (!in || !out) return -2;
+    fwrite(input, 1, input_len, in);
+    rewind(in);
+
+    // Exercise both sources: FILE reads for even thread counts, the in-memory
+    // buffer path (as used for memory-mapped files) for odd ones.
+    int ret = (num_threads % 2 == 0)
+        ? map_to_cartesian_stream_format(in, out, separator, num_threads, format, record_size)
+        : map_to_cartesian_buffer_format(input, input_len, out, separator, num_threads, format, record_size);
+    rewind(out);
+    size_t got = fread(out_buf, 1, out_size - 1, out);
+    out_buf[got] = '\0';
+    fclose(in);
+    fclose(out);
+    return ret;
+}
+
+static int run_stream(const char* input, size_t input_len, char separator, int num_threads,
+                      char* out_buf, size_t out_size) {
+    return run_stream_format(input, input_len, MAPPER_INPUT_DECIMAL, 0, separator, num_threads, out_buf, out_size);
+}
+
+// Test map_to_cartesian_stream output format, ordering and error handling
+static int test_stream_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char out_buf[1 << 24];
+    static char expected[1 << 24];
+
+    printf("--- Testing map_to_cartesian_stream ---\n");
+
+    const char* input = "123\n\n0\r\n12a3\n9210836494447108270027136741376870869791784014198948301625976867708124077590\n7";
+    const char* expected_csv =
+        "number,theta,ring,x,y\n"
+        "123,3,3,3.56402612,1.81596196\n"
+        "0,0,0,1.00000000,0.00000000\n"
+        "9210836494447108270027136741376870869791784014198948301625976867708124077590,30,56,0.00000000,-57.00000000\n"
+        "7,7,0,0.45399049,0.89100653\n";
+    int ret = run_stream(input, strlen(input), ',', 2, out_buf, sizeof(out_buf));
+    int buffer_ret = run_stream(input, strlen(input), ',', 1, out_buf + strlen(out_buf) + 1,
+                                sizeof(out_buf) - strlen(out_buf) - 1);
+    total_tests++;
+    if (ret == 1 && buffer_ret == 1 && strcmp(out_buf, expected_csv) == 0 &&
+        strcmp(out_buf + strlen(out_buf) + 1, expected_csv) == 0) {
+        printf("[PASS] Test: CSV rows, blank/CRLF/invalid lines -> 1 invalid line\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: CSV rows -> Ret: %d, Output:\n%s\n", ret, out_buf);
+    }
+
+    ret = run_stream("5\n", 2, '\t', 1, out_buf, sizeof(out_buf));
+    total_tests++;
+    if (ret == 0 && strcmp(out_buf, "number\ttheta\tring\tx\ty\n5\t5\t0\t0.70710677\t0.70710677\n") == 0) {
+        printf("[PASS] Test: TSV row\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: TSV row -> Ret: %d, Output:\n%s\n", ret, out_buf);
+    }
+
+    // Enough lines to span several batches; output must match a single-key loop in order.
+    size_t count = 120000;
+    size_t input_cap = count * 24;
+    char* many = malloc(input_cap);
+    size_t many_len = 0;
+    size_t expected_len = (size_t)snprintf(expected, sizeof(expected), "number,theta,ring,x,y\n");
+    int expected_ok = (many != NULL);
+    for (size_t i = 0; i < count && expected_ok; ++i) {
+        char key[24];
+        int key_len = snprintf(key, sizeof(key), "%zu", i * 2654435761u);
+        memcpy(many + many_len, key, (size_t)key_len);
+        many_len += (size_t)key_len;
+        many[many_len++] = '\n';
+
+        float x, y;
+        map_to_cartesian(key, &x, &y);
+        int residue = calculate_large_mod(key, SPIRAL_PERIOD);
+        expected_len += (size_t)snprintf(expected + expected_len, sizeof(expected) - expected_len,
+                                         "%s,%d,%d,%.8f,%.8f\n", key, residue % 40, residue / 40, x, y);
+        if (expected_len >= sizeof(expected)) expected_ok = 0;
+    }
+    total_tests++;
+    if (expected_ok && many_len > STREAM_BATCH_BYTES &&
+        run_stream(many, many_len, ',', 3, out_buf, sizeof(out_buf)) == 0 &&
+        strcmp(out_buf, expected) == 0) {
+        printf("[PASS] Test: %zu lines across batches keep input order\n", count);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: %zu lines across batches differ from map_to_cartesian\n", count);
+    }
+    total_tests++;
+    if (expected_ok && run_stream(many, many_len, ',', 4, out_buf, sizeof(out_buf)) == 0 &&
+        strcmp(out_buf, expected) == 0) {
+        printf("[PASS] Test: FILE and in-memory sources produce the same rows\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: FILE and in-memory sources differ\n");
+    }
+    free(many);
+
+    total_tests++;
+    if (map_to_cartesian_stream(NULL, stdout, ',', 1) == -1 && map_to_cartesian_buffer(NULL, 0, stdout, ',', 1) == -1) {
+        printf("[PASS] Test: NULL stream -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: NULL stream -> Expected Ret: -1\n");
+    }
+
+    printf("--- map_to_cartesian_stream tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Test the hex and binary inputs against the decimal path
+static int test_hex_binary_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char out_buf[1 << 23];
+    static char expected[1 << 23];
+
+    printf("--- Testing map_to_cartesian_hex / map_to_cartesian_bytes ---\n");
+
+    float ex, ey, x, y, bx, by;
+    map_to_cartesian("9210836494447108270027136741376870869791784014198948301625976867708124077590", &ex, &ey);
+    total_tests++;
+    if (map_to_cartesian_hex("0x145d2611c823a396ef6712ce0f712f09b9b4f3135e3e0aa3230fb9b6d08d1e16", &x, &y) == 0 &&
+        x == ex && y == ey) {
+        printf("[PASS] Test: Example number in hex -> same coordinates as decimal\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Example number in hex -> differs from decimal\n");
+    }
+
+    // Values that fit in 64 bits, so their decimal text is easy to produce. Each is a
+    // 32-byte record with zero high bytes and a hex line.
+    size_t count = 40000;
+    const size_t record_size = 32;
+    char* records = calloc(count, record_size);
+    char* hex_lines = malloc(count * 20);
+    size_t hex_len = 0;
+    size_t expected_len = (size_t)snprintf(expected, sizeof(expected), "number,theta,ring,x,y\n");
+    size_t hex_rows = 0;
+    int single_ok = (records && hex_lines);
+    for (size_t i = 0; i < count && single_ok; ++i) {
+        unsigned long long value = (unsigned long long)i * 0x9E3779B97F4A7C15ULL;
+        char decimal[24];
+        snprintf(decimal, sizeof(decimal), "%llu", value);
+        unsigned char* record = (unsigned char*)records + i * record_size;
+        for (int b = 0; b < 8; ++b) record[record_size - 1 - b] = (unsigned char)(value >> (8 * b));
+        hex_len += (size_t)snprintf(hex_lines + hex_len, 20, "%llx\n", value);
+
+        map_to_cartesian(decimal, &ex, &ey);
+        if (map_to_cartesian_bytes(record, record_size, &bx, &by) != 0 || bx != ex || by != ey) single_ok = 0;
+        int residue = calculate_large_mod(decimal, SPIRAL_PERIOD);
+        char number[2 * 32 + 1];
+        for (size_t b = 0; b < record_size; ++b) snprintf(number + 2 * b, 3, "%02x", record[b]);
+        expected_len += (size_t)snprintf(expected + expected_len, sizeof(expected) - expected_len,
+                                         "%s,%d,%d,%.8f,%.8f\n", number, residue % 40, residue / 40, ex, ey);
+    }
+    total_tests++;
+    if (single_ok) {
+        printf("[PASS] Test: %zu 32-byte records -> same coordinates as decimal\n", count);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: 32-byte records differ from decimal\n");
+    }
+
+    total_tests++;
+    if (single_ok && count * record_size > STREAM_BATCH_BYTES &&
+        run_stream_format(records, count * record_size, MAPPER_INPUT_BINARY, record_size, ',', 3, out_buf, sizeof(out_buf)) == 0 &&
+        strcmp(out_buf, expected) == 0 &&
+        run_stream_format(records, count * record_size, MAPPER_INPUT_BINARY, record_size, ',', 2, out_buf, sizeof(out_buf)) == 0 &&
+        strcmp(out_buf, expected) == 0) {
+        printf("[PASS] Test: Binary records across batches, FILE and in-memory -> same rows as decimal\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Binary record stream differs from decimal\n");
+    }
+
+    // The hex stream echoes each line, so compare everything after the number column.
+    int hex_ok = single_ok &&
+        run_stream_format(hex_lines, hex_len, MAPPER_INPUT_HEX, 0, ',', 2, out_buf, sizeof(out_buf)) == 0;
+    const char* got_row = strchr(out_buf, '\n');
+    const char* want_row = strchr(expected, '\n');
+    while (hex_ok && got_row && want_row && got_row[1] && want_row[1]) {
+        const char* got_cell = strchr(got_row + 1, ',');
+        const char* want_cell = strchr(want_row + 1, ',');
+        got_row = strchr(got_row + 1, '\n');
+        want_row = strchr(want_row + 1, '\n');
+        if (!got_cell || !want_cell || !got_row || !want_row ||
+            got_row - got_cell != want_row - want_cell || memcmp(got_cell, want_cell, (size_t)(got_row - got_cell)) != 0) {
+            hex_ok = 0;
+        }
+        hex_rows++;
+    }
+    total_tests++;
+    if (hex_ok && hex_rows == count) {
+        printf("[PASS] Test: Hex lines -> same cells as decimal\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Hex lines differ from decimal\n");
+    }
+    free(records);
+    free(hex_lines);
+
+    // 0x01020304 = 16909060, residue 2940
+    snprintf(expected, sizeof(expected), "number,theta,ring,x,y\n01020304,20,73,%.8f,%.8f\n",
+             spiral_point_table[2940].x, spiral_point_table[2940].y);
+    total_tests++;
+    if (run_stream_format("\x01\x02\x03\x04\x05", 5, MAPPER_INPUT_BINARY, 4, ',', 1, out_buf, sizeof(out_buf)) == 1 &&
+        strcmp(out_buf, expected) == 0 &&
+        map_to_cartesian_hex("0xg", &x, &y) == -1 && map_to_cartesian_bytes(NULL, 4, &x, &y) == -1 &&
+        map_to_cartesian_buffer_format("", 0, stdout, ',', 1, MAPPER_INPUT_BINARY, 0) == -1) {
+        printf("[PASS] Test: Short final record, bad hex, NULL bytes, zero record size -> invalid\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Short final record, bad hex, NULL bytes, zero record size -> Expected invalid\n");
+    }
+
+    printf("--- hex/binary mapping tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Builds the newline-delimited decimal numbers first .. first + count - 1 into out.
+static size_t build_consecutive_lines(const char* first, size_t count, char* out) {
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        calculate_large_add_to_string(first, i, out + len, strlen(first) + 22);
+        len += strlen(out + len);
+        out[len++] = '\n';
+    }
+    return len;
+}
+
+// Test map_to_cartesian_range and map_to_cartesian_range_stream against per-number mapping
+static int test_range_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char out_buf[1 << 24];
+    static char expected[1 << 24];
+    static char lines[1 << 24];
+
+    printf("--- Testing map_to_cartesian_range ---\n");
+
+    const char* big = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
+    size_t count = 50000;
+    float* x = malloc(count * sizeof(*x));
+    float* y = malloc(count * sizeof(*y));
+    char number[128];
+    int range_ok = (x && y);
+    const char* firsts[] = { "0", "00995", big };
+    for (size_t f = 0; f < sizeof(firsts) / sizeof(firsts[0]) && range_ok; ++f) {
+        if (map_to_cartesian_range(firsts[f], count, x, y, 3) != 0) range_ok = 0;
+        for (size_t i = 0; i < count && range_ok; i += 7) {
+            float ex, ey;
+            calculate_large_add_to_string(firsts[f], i, number, sizeof(number));
+            map_to_cartesian(number, &ex, &ey);
+            if (x[i] != ex || y[i] != ey) range_ok = 0;
+        }
+    }
+    total_tests++;
+    if (range_ok) {
+        printf("[PASS] Test: range arrays match map_to_cartesian\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: range arrays differ from map_to_cartesian\n");
+    }
+    free(x);
+    free(y);
+
+    float small_x[4], small_y[4];
+    total_tests++;
+    if (map_to_cartesian_range("12a", 4, small_x, small_y, 1) == -1 &&
+        map_to_cartesian_range(NULL, 4, small_x, small_y, 1) == -1 &&
+        map_to_cartesian_range("12", 4, NULL, small_y, 1) == -1) {
+        printf("[PASS] Test: invalid range start -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: invalid range start -> Expected Ret: -1\n");
+    }
+
+    // A carry into a new digit (...999 -> 1000...), a single value, and a range
+    // spanning several blocks that carries mid-block.
+    struct { const char* first; size_t count; } ranges[] = {
+        { "995", 11 },
+        { "0", 1 },
+        { "99999999999999999999999999999000", 200000 },
+    };
+    int stream_ok = 1;
+    for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]) && stream_ok; ++r) {
+        size_t n = ranges[r].count;
+        calculate_large_add_to_string(ranges[r].first, n - 1, number, sizeof(number));
+        const char* last = number;
+        size_t lines_len = build_consecutive_lines(ranges[r].first, n, lines);
+        if (run_stream(lines, lines_len, ',', 3, expected, sizeof(expected)) != 0) stream_ok = 0;
+
+        FILE* out = tmpfile();
+        if (!out || map_to_cartesian_range_stream(ranges[r].first, last, out, ',', 3) != 0) stream_ok = 0;
+        if (out) {
+            rewind(out);
+            size_t got = fread(out_buf, 1, sizeof(out_buf) - 1, out);
+            out_buf[got] = '\0';
+            fclose(out);
+        }
+        if (strcmp(out_buf, expected) != 0) stream_ok = 0;
+    }
+    total_tests++;
+    if (stream_ok) {
+        printf("[PASS] Test: range stream matches streaming the same numbers\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: range stream differs from streaming the same numbers\n");
+    }
+
+    total_tests++;
+    if (map_to_cartesian_range_stream("5", "4", stdout, ',', 1) == -1 &&
+        map_to_cartesian_range_stream("0", "18446744073709551616", stdout, ',', 1) == -1 &&
+        map_to_cartesian_range_stream("1x", "4", stdout, ',', 1) == -1) {
+        printf("[PASS] Test: reversed, too long or invalid range -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: reversed, too long or invalid range -> Expected Ret: -1\n");
+    }
+
+    printf("--- map_to_cartesian_range tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Test map_to_cartesian_histogram against counting calculate_large_mod results
+static int test_histogram_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char lines[1 << 22];
+    static unsigned long long expected[MAPPER_CELL_COUNT];
+    static unsigned long long counts[MAPPER_CELL_COUNT];
+
+    printf("--- Testing map_to_cartesian_histogram ---\n");
+
+    const char* first = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
+    size_t count = 30000;
+    size_t len = build_consecutive_lines(first, count, lines);
+    memset(expected, 0, sizeof(expected));
+    for (size_t start = 0; start < len;) {
+        size_t end = start;
+        while (lines[end] != '\n') end++;
+        lines[end] = '\0';
+        expected[calculate_large_mod(lines + start, SPIRAL_PERIOD)]++;
+        lines[end] = '\n';
+        start = end + 1;
+    }
+
+    int counts_ok = 1;
+    const int thread_counts[] = { 1, 2, 5 };
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t) {
+        FILE* in = tmpfile();
+        if (!in) {
+            counts_ok = 0;
+            break;
+        }
+        fwrite(lines, 1, len, in);
+        rewind(in);
+        memset(counts, 0xff, sizeof(counts));
+        if (map_to_cartesian_histogram(in, counts, thread_counts[t], MAPPER_INPUT_DECIMAL, 0) != 0 ||
+            memcmp(counts, expected, sizeof(counts)) != 0) {
+            counts_ok = 0;
+        }
+        fclose(in);
+        memset(counts, 0xff, sizeof(counts));
+        if (map_to_cartesian_histogram_buffer(lines, len, counts, thread_counts[t], MAPPER_INPUT_DECIMAL, 0) != 0 ||
+            memcmp(counts, expected, sizeof(counts)) != 0) {
+            counts_ok = 0;
+        }
+    }
+    total_tests++;
+    if (counts_ok) {
+        printf("[PASS] Test: %zu numbers, FILE and buffer, 1/2/5 threads -> same counts as calculate_large_mod\n", count);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Histogram counts differ from calculate_large_mod\n");
+    }
+
+    // 0x01020304 = 16909060 -> residue 2940; the short trailing record is invalid
+    const unsigned char records[] = { 0x01, 0x02, 0x03, 0x04, 0x01, 0x02, 0x03, 0x04, 0x00, 0x00, 0x00, 0x05, 0x07 };
+    int invalid = map_to_cartesian_histogram_buffer((const char*)records, sizeof(records), counts, 2,
+                                                    MAPPER_INPUT_BINARY, 4);
+    unsigned long long total = 0;
+    for (int r = 0; r < MAPPER_CELL_COUNT; ++r) total += counts[r];
+    total_tests++;
+    if (invalid == 1 && counts[2940] == 2 && counts[5] == 1 && total == 3) {
+        printf("[PASS] Test: Binary records -> 2 hits in cell 2940, 1 in cell 5, 1 invalid\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Binary records -> Got %d invalid, %llu/%llu hits, %llu total\n", invalid,
+               counts[2940], counts[5], total);
+    }
+
+    const char* mixed = "7\nabc\n\n3087\n0x1\n";
+    invalid = map_to_cartesian_histogram_buffer(mixed, strlen(mixed), counts, 3, MAPPER_INPUT_DECIMAL, 0);
+    total_tests++;
+    if (invalid == 2 && counts[7] == 2 &&
+        map_to_cartesian_histogram(NULL, counts, 1, MAPPER_INPUT_DECIMAL, 0) == -1 &&
+        map_to_cartesian_histogram_buffer(mixed, strlen(mixed), NULL, 1, MAPPER_INPUT_DECIMAL, 0) == -1 &&
+        map_to_cartesian_histogram_buffer("1", 1, counts, 1, MAPPER_INPUT_BINARY, 0) == -1) {
+        printf("[PASS] Test: Invalid lines counted, NULL pointers and zero record size -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Invalid input handling -> Got %d invalid, %llu hits in cell 7\n", invalid, counts[7]);
+    }
+
+    printf("--- map_to_cartesian_histogram tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Renders counts to a temporary file and reads the image back into image (up to
+// size bytes). Returns the number of bytes read, or 0 if rendering failed.
+static size_t render_to_buffer(const struct mapper_geometry* geometry, const unsigned long long* counts, int width,
+                               int height, enum mapper_image_format format, unsigned char* image, size_t size) {
+    FILE* out = tmpfile();
+    if (!out) return 0;
+    size_t len = 0;
+    if (mapper_render_density(geometry, counts, width, height, format, out) == 0) {
+        rewind(out);
+        len = fread(image, 1, size, out);
+    }
+    fclose(out);
+    return len;
+}
+
+// Test mapper_render_density on hand-placed counts and the geometry histograms
+static int test_render_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static unsigned long long counts[MAPPER_CELL_COUNT];
+    static unsigned char image[3 * 101 * 101 + 64];
+
+    printf("--- Testing mapper_render_density ---\n");
+
+    // 101 x 101 fits radius 77 into 50 pixels: (1, 0) -> (51, 50), (77, 0) -> (100, 50)
+    memset(counts, 0, sizeof(counts));
+    counts[0] = 5;
+    counts[SPIRAL_ANGULAR_DIVISIONS * (SPIRAL_RING_COUNT - 1)] = 1;
+    const char header[] = "P5\n101 101\n255\n";
+    size_t header_len = strlen(header);
+    size_t len = render_to_buffer(NULL, counts, 101, 101, MAPPER_IMAGE_PGM, image, sizeof(image));
+    size_t lit = 0;
+    for (size_t i = header_len; i < len; ++i) lit += image[i] != 0;
+    total_tests++;
+    // 1 + 254 * log(2) / log(6) rounds to 99
+    if (len == header_len + 101 * 101 && memcmp(image, header, header_len) == 0 && lit == 2 &&
+        image[header_len + 50 * 101 + 51] == 255 && image[header_len + 50 * 101 + 100] == 99) {
+        printf("[PASS] Test: PGM 101x101 -> 5 hits at (51, 50) level 255, 1 hit at (100, 50) level 99\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: PGM 101x101 -> Got %zu bytes, %zu lit pixels\n", len, lit);
+    }
+
+    // One hit in every cell, each on its own pixel at 1001 x 1001: all full white
+    for (int r = 0; r < MAPPER_CELL_COUNT; ++r) counts[r] = 1;
+    static unsigned char large_image[1001 * 1001 + 64];
+    len = render_to_buffer(NULL, counts, 1001, 1001, MAPPER_IMAGE_PGM, large_image, sizeof(large_image));
+    size_t dim = 0;
+    lit = 0;
+    for (size_t i = strlen("P5\n1001 1001\n255\n"); i < len; ++i) {
+        lit += large_image[i] != 0;
+        dim += large_image[i] != 0 && large_image[i] != 255;
+    }
+    total_tests++;
+    if (len == strlen("P5\n1001 1001\n255\n") + 1001 * 1001 && lit == MAPPER_CELL_COUNT && dim == 0) {
+        printf("[PASS] Test: One hit per cell at 1001x1001 -> %zu lit pixels, all level 255\n", lit);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: One hit per cell -> %zu lit pixels, %zu below level 255\n", lit, dim);
+    }
+
+    // At 1 x 1 every cell lands on the one pixel, which is the densest
+    for (int r = 0; r < MAPPER_CELL_COUNT; ++r) counts[r] = (unsigned long long)r;
+    const char header_ppm[] = "P6\n1 1\n255\n";
+    len = render_to_buffer(NULL, counts, 1, 1, MAPPER_IMAGE_PPM, image, sizeof(image));
+    total_tests++;
+    if (len == strlen(header_ppm) + 3 && memcmp(image, header_ppm, strlen(header_ppm)) == 0 &&
+        image[len - 3] == 255 && image[len - 2] == 255 && image[len - 1] == 255) {
+        printf("[PASS] Test: PPM 1x1 -> all cells merged into one white pixel\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: PPM 1x1 -> Got %zu bytes\n", len);
+    }
+
+    // A 7 x 3 geometry counted on 1 and 3 threads matches calculate_large_mod by 21
+    struct mapper_geometry geometry;
+    unsigned long long expected[21] = {0};
+    unsigned long long geometry_counts[21];
+    char lines[8 * 2000];
+    size_t lines_len = 0;
+    for (int n = 0; n < 2000; ++n) {
+        char number[16];
+        snprintf(number, sizeof(number), "%d", n * 37 + 5);
+        expected[calculate_large_mod(number, 21)]++;
+        lines_len += (size_t)sprintf(lines + lines_len, "%s\n", number);
+    }
+    int geometry_ok = mapper_geometry_init(&geometry, 7, 3, 0.5f) == 0;
+    for (int threads = 1; geometry_ok && threads <= 3; threads += 2) {
+        memset(geometry_counts, 0xff, sizeof(geometry_counts));
+        geometry_ok = map_to_cartesian_histogram_buffer_geometry(&geometry, lines, lines_len, geometry_counts, threads,
+                                                                 MAPPER_INPUT_DECIMAL, 0) == 0 &&
+                      memcmp(geometry_counts, expected, sizeof(expected)) == 0;
+        FILE* in = tmpfile();
+        if (!in) {
+            geometry_ok = 0;
+            break;
+        }
+        fwrite(lines, 1, lines_len, in);
+        rewind(in);
+        memset(geometry_counts, 0xff, sizeof(geometry_counts));
+        geometry_ok = geometry_ok &&
+                      map_to_cartesian_histogram_geometry(&geometry, in, geometry_counts, threads,
+                                                          MAPPER_INPUT_DECIMAL, 0) == 0 &&
+                      memcmp(geometry_counts, expected, sizeof(expected)) == 0;
+        fclose(in);
+    }
+    len = render_to_buffer(&geometry, geometry_counts, 64, 32, MAPPER_IMAGE_PGM, image, sizeof(image));
+    total_tests++;
+    if (geometry_ok && len == strlen("P5\n64 32\n255\n") + 64 * 32) {
+        printf("[PASS] Test: 7x3 geometry histogram, FILE and buffer, 1/3 threads -> counts mod 21, renders 64x32\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: 7x3 geometry histogram or render -> Got %zu bytes\n", len);
+    }
+    mapper_geometry_free(&geometry);
+
+    total_tests++;
+    if (mapper_render_density(NULL, NULL, 8, 8, MAPPER_IMAGE_PGM, stdout) == -1 &&
+        mapper_render_density(NULL, counts, 8, 8, MAPPER_IMAGE_PGM, NULL) == -1 &&
+        mapper_render_density(NULL, counts, 0, 8, MAPPER_IMAGE_PGM, stdout) == -1 &&
+        mapper_render_density(NULL, counts, 8, MAPPER_RENDER_MAX_SIDE + 1, MAPPER_IMAGE_PPM, stdout) == -1) {
+        printf("[PASS] Test: NULL pointers and sides outside 1 .. %d -> Ret: -1\n", MAPPER_RENDER_MAX_SIDE);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Invalid render arguments accepted\n");
+    }
+
+    printf("--- mapper_render_density tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Test mapper_index_build and mapper_index_cell against filtering the input per cell
+static int test_index_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char lines[1 << 22];
+    static char expected[1 << 22];
+    static int residues[30000];
+    static size_t starts[30000 + 1];
+
+    printf("--- Testing mapper_index ---\n");
+
+    char path[] = "/tmp/mapper_index_test_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        printf("[FAIL] Could not create a temporary index file\n");
+        return 0;
+    }
+    close(fd);
+
+    const char* first = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
+    size_t count = 30000;
+    size_t len = build_consecutive_lines(first, count, lines);
+    for (size_t i = 0, start = 0; i < count; ++i) {
+        size_t end = start;
+        while (lines[end] != '\n') end++;
+        residues[i] = spiral_residue_n(lines + start, end - start);
+        starts[i] = start;
+        start = end + 1;
+    }
+    starts[count] = len;
+    const int thread_counts[] = { 1, 3 };
+    int index_ok = 1;
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]) && index_ok; ++t) {
+        struct mapper_index index;
+        if (mapper_index_build(lines, len, path, thread_counts[t], MAPPER_INPUT_DECIMAL, 0) != 0 ||
+            mapper_index_open(path, &index) != 0) {
+            index_ok = 0;
+            break;
+        }
+        size_t total = 0;
+        for (int r = 0; r < SPIRAL_PERIOD && index_ok; ++r) {
+            size_t expected_len = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (residues[i] != r) continue;
+                memcpy(expected + expected_len, lines + starts[i], starts[i + 1] - starts[i]);
+                expected_len += starts[i + 1] - starts[i];
+            }
+            const char* keys;
+            size_t keys_len;
+            if (mapper_index_cell(&index, r % SPIRAL_ANGULAR_DIVISIONS, r / SPIRAL_ANGULAR_DIVISIONS, &keys,
+                                  &keys_len) != 0 || keys_len != expected_len ||
+                memcmp(keys, expected, keys_len) != 0) {
+                index_ok = 0;
+            }
+            total += keys_len;
+        }
+        if (total != len) index_ok = 0;
+        mapper_index_close(&index);
+    }
+    total_tests++;
+    if (index_ok) {
+        printf("[PASS] Test: %zu numbers, 1/3 threads -> every cell holds its keys in input order\n", count);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Indexed cells differ from filtering the input\n");
+    }
+
+    // 0x01020304 -> cell 2940 (theta 20, ring 73); "\r\n", a blank and an invalid line in text input
+    const unsigned char records[] = { 0x01, 0x02, 0x03, 0x04, 0x00, 0x00, 0x00, 0x05, 0x01, 0x02, 0x03, 0x04 };
+    struct mapper_index index;
+    const char* keys = NULL;
+    size_t keys_len = 0;
+    int binary_ok = mapper_index_build((const char*)records, sizeof(records), path, 2, MAPPER_INPUT_BINARY, 4) == 0 &&
+                    mapper_index_open(path, &index) == 0;
+    if (binary_ok) {
+        binary_ok = index.record_size == 4 && mapper_index_cell(&index, 20, 73, &keys, &keys_len) == 0 &&
+                    keys_len == 8 && memcmp(keys, records, 4) == 0 && memcmp(keys + 4, records + 8, 4) == 0;
+        mapper_index_close(&index);
+    }
+    const char* text = "3081\r\n\nabc\n1";
+    int invalid = mapper_index_build(text, strlen(text), path, 1, MAPPER_INPUT_DECIMAL, 0);
+    int text_ok = invalid == 1 && mapper_index_open(path, &index) == 0;
+    if (text_ok) {
+        text_ok = index.record_size == 0 && mapper_index_cell(&index, 1, 0, &keys, &keys_len) == 0 &&
+                  keys_len == 7 && memcmp(keys, "3081\n1\n", 7) == 0;
+        mapper_index_close(&index);
+    }
+    total_tests++;
+    if (binary_ok && text_ok) {
+        printf("[PASS] Test: Binary records, \"\\r\\n\", blank and invalid lines -> expected cells\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Binary or mixed text index -> binary %d, text %d (invalid %d)\n", binary_ok, text_ok,
+               invalid);
+    }
+
+    // A truncated file must be rejected, as must out-of-range cells and NULL pointers.
+    FILE* truncated = fopen(path, "wb");
+    if (truncated) {
+        fwrite("SPIRIDX1", 1, 8, truncated);
+        fclose(truncated);
+    }
+    int reject_ok = mapper_index_open(path, &index) == -1 &&
+                    mapper_index_build(NULL, 0, path, 1, MAPPER_INPUT_DECIMAL, 0) == -1 &&
+                    mapper_index_build("1", 1, path, 1, MAPPER_INPUT_BINARY, 0) == -1 &&
+                    mapper_index_build("1\n", 2, path, 1, MAPPER_INPUT_DECIMAL, 0) == 0 &&
+                    mapper_index_open(path, &index) == 0;
+    if (reject_ok) {
+        reject_ok = mapper_index_cell(&index, 40, 0, &keys, &keys_len) == -1 &&
+                    mapper_index_cell(&index, 0, 77, &keys, &keys_len) == -1 &&
+                    mapper_index_cell(&index, -1, 0, &keys, &keys_len) == -1 &&
+                    mapper_index_cell(&index, 0, 0, NULL, &keys_len) == -1;
+        mapper_index_close(&index);
+    }
+    total_tests++;
+    if (reject_ok) {
+        printf("[PASS] Test: Truncated index, NULL data, zero record size, bad cell -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Invalid index input -> Expected Ret: -1\n");
+    }
+    unlink(path);
+
+    printf("--- mapper_index tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Test map_to_cartesian_range_counts and map_to_cartesian_range_key against stepping through small ranges
+static int test_range_counts_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char lines[1 << 21];
+    static unsigned long long expected[MAPPER_CELL_COUNT];
+    static unsigned char extra[MAPPER_CELL_COUNT];
+
+    printf("--- Testing map_to_cartesian_range_counts ---\n");
+
+    // Ranges shorter than, equal to and longer than one period, from small and 76-digit starts
+    struct {
+        const char* first;
+        size_t count;
+    } ranges[] = {
+        {"0", 1},
+        {"1", 3080},
+        {"3079", 7000},
+        {"9210836494447108270027136741376870869791784014198948301625976867708124077590", 20000},
+    };
+    int counts_ok = 1;
+    int keys_ok = 1;
+    for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); ++r) {
+        size_t len = build_consecutive_lines(ranges[r].first, ranges[r].count, lines);
+        memset(expected, 0, sizeof(expected));
+        char last[128] = "";
+        for (size_t start = 0; start < len;) {
+            size_t end = start;
+            while (lines[end] != '\n') end++;
+            expected[spiral_residue_n(lines + start, end - start)]++;
+            memcpy(last, lines + start, end - start);
+            last[end - start] = '\0';
+            start = end + 1;
+        }
+
+        char base[128];
+        if (map_to_cartesian_range_counts(ranges[r].first, last, base, sizeof(base), extra) != 0) {
+            counts_ok = 0;
+            continue;
+        }
+        unsigned long long base_count = strtoull(base, NULL, 10);
+        for (int c = 0; c < MAPPER_CELL_COUNT; ++c) {
+            if (base_count + extra[c] != expected[c]) counts_ok = 0;
+        }
+
+        // The k-th key of a few cells is the k-th line with that residue; one past the end fails.
+        const int cells[] = { 0, 5, 2939, 3079 };
+        for (size_t c = 0; c < sizeof(cells) / sizeof(cells[0]); ++c) {
+            unsigned long long k = 0;
+            char key[128];
+            for (size_t start = 0; start < len;) {
+                size_t end = start;
+                while (lines[end] != '\n') end++;
+                if (spiral_residue_n(lines + start, end - start) == cells[c]) {
+                    if (map_to_cartesian_range_key(ranges[r].first, last, cells[c] % SPIRAL_ANGULAR_DIVISIONS,
+                                                   cells[c] / SPIRAL_ANGULAR_DIVISIONS, k, key, sizeof(key)) != 0 ||
+                        strlen(key) != end - start || memcmp(key, lines + start, end - start) != 0) {
+                        keys_ok = 0;
+                    }
+                    k++;
+                }
+                start = end + 1;
+            }
+            if (map_to_cartesian_range_key(ranges[r].first, last, cells[c] % SPIRAL_ANGULAR_DIVISIONS,
+                                           cells[c] / SPIRAL_ANGULAR_DIVISIONS, k, key, sizeof(key)) != -1) {
+                keys_ok = 0;
+            }
+        }
+    }
+    total_tests++;
+    if (counts_ok) {
+        printf("[PASS] Test: Ranges of 1 to 20000 integers -> same counts per cell as stepping through them\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Range counts differ from stepping through the range\n");
+    }
+    total_tests++;
+    if (keys_ok) {
+        printf("[PASS] Test: k-th key of cells 0, 5, 2939, 3079 -> same as stepping; one past the end -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: k-th key differs from stepping through the range\n");
+    }
+
+    // 0 .. 10^40 - 1: 10^40 = 3080 * base + 760, so cells 0 .. 759 get one more
+    char base[64];
+    char key[64];
+    const char* last = "9999999999999999999999999999999999999999";
+    int big_ok = map_to_cartesian_range_counts("0", last, base, sizeof(base), extra) == 0 &&
+                 strcmp(base, "3246753246753246753246753246753246753") == 0 && extra[759] == 1 && extra[760] == 0 &&
+                 map_to_cartesian_range_key("0", last, 0, 0, 18446744073709551615ULL, key, sizeof(key)) == 0 &&
+                 strcmp(key, "56815971747025418974200") == 0;
+    total_tests++;
+    if (big_ok) {
+        printf("[PASS] Test: 0 .. 10^40 - 1 -> base \"%s\", key 2^64 - 1 of cell 0 = \"%s\"\n", base, key);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: 0 .. 10^40 - 1 -> base \"%s\", key \"%s\"\n", base, key);
+    }
+
+    total_tests++;
+    if (map_to_cartesian_range_counts("5", "4", base, sizeof(base), extra) == -1 &&
+        map_to_cartesian_range_counts("1x", "4", base, sizeof(base), extra) == -1 &&
+        map_to_cartesian_range_counts("1", "4", base, sizeof(base), NULL) == -1 &&
+        map_to_cartesian_range_key("1", "100", 40, 0, 0, key, sizeof(key)) == -1 &&
+        map_to_cartesian_range_key("1", "100", 0, 77, 0, key, sizeof(key)) == -1 &&
+        map_to_cartesian_range_key("1", "100", 0, 0, 0, key, sizeof(key)) == -1 &&
+        map_to_cartesian_range_key("1", "100", 10, 0, 0, key, 2) == -1) {
+        printf("[PASS] Test: Reversed or invalid bounds, bad cell, empty cell, small buffer -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Invalid range arguments -> Expected Ret: -1\n");
+    }
+
+    printf("--- map_to_cartesian_range_counts tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Writes the rows of a geometry stream (buffer path for odd thread counts) or
+// range stream (first_str non-NULL) to out_buf.
+static int run_geometry_stream(const struct mapper_geometry* geometry, const char* input, size_t input_len,
+                               const char* first_str, const char* last_str, int num_threads,
+                               char* out_buf, size_t out_size) {
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    if (!in || !out) return -2;
+    fwrite(input, 1, input_len, in);
+    rewind(in);
+    int ret;
+    if (first_str) {
+        ret = map_to_cartesian_range_stream_geometry(geometry, first_str, last_str, out, ',', num_threads);
+    } else if (num_threads % 2 == 0) {
+        ret = map_to_cartesian_stream_geometry(geometry, in, out, ',', num_threads, MAPPER_INPUT_DECIMAL, 0);
+    } else {
+        ret = map_to_cartesian_buffer_geometry(geometry, input, input_len, out, ',', num_threads,
+                                               MAPPER_INPUT_DECIMAL, 0);
+    }
+    rewind(out);
+    size_t got = fread(out_buf, 1, out_size - 1, out);
+    out_buf[got] = '\0';
+    fclose(in);
+    fclose(out);
+    return ret;
+}
+
+// Test mapper_geometry_init and the geometry variants of mapping and streaming
+static int test_geometry_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char lines[1 << 20];
+    static char out_buf[1 << 22];
+    static char expected[1 << 22];
+    struct mapper_geometry geometry;
+    float x, y;
+    int theta, ring;
+
+    printf("--- Testing mapper_geometry_init / map_to_cartesian_geometry ---\n");
+
+    // 40 x 77 with offset 1 is the built-in spiral: same table, same cells
+    int builtin_ok = mapper_geometry_init(&geometry, 40, 77, 1.0f) == 0 && geometry.points == spiral_point_table &&
+                     geometry.owned_points == NULL;
+    const char* numbers[] = {"0", "39", "40", "3079", "3080", "123456789012345678901234567890",
+                             "9210836494447108270027136741376870869791784014198948301625976867708124077590"};
+    for (size_t i = 0; builtin_ok && i < sizeof(numbers) / sizeof(numbers[0]); ++i) {
+        float ex, ey;
+        int r = spiral_residue(numbers[i]);
+        if (map_to_cartesian_geometry(&geometry, numbers[i], &theta, &ring, &x, &y) != 0 ||
+            map_to_cartesian(numbers[i], &ex, &ey) != 0 || x != ex || y != ey || theta != r % 40 || ring != r / 40) {
+            builtin_ok = 0;
+        }
+    }
+    mapper_geometry_free(&geometry);
+    total_tests++;
+    if (builtin_ok) {
+        printf("[PASS] Test: 40 x 77, offset 1 -> built-in table, same cells and points as map_to_cartesian\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: 40 x 77, offset 1 differs from map_to_cartesian\n");
+    }
+
+    // The multiply-shift split agrees with / and % for every residue
+    int shapes[][2] = {{4, 2}, {7, 1}, {1, 5}, {360, 180}, {1024, 1024}, {MAPPER_GEOMETRY_MAX_CELLS, 1}};
+    int split_ok = 1;
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); ++s) {
+        if (mapper_geometry_init(&geometry, shapes[s][0], shapes[s][1], 0.0f) != 0) {
+            split_ok = 0;
+            continue;
+        }
+        for (int r = 0; r < geometry.cell_count; ++r) {
+            geometry_split(&geometry, r, &theta, &ring);
+            if (theta != r % shapes[s][0] || ring != r / shapes[s][0]) split_ok = 0;
+        }
+        mapper_geometry_free(&geometry);
+    }
+    total_tests++;
+    if (split_ok) {
+        printf("[PASS] Test: Split of every residue of 4x2 .. 1024x1024 -> same as / and %%\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Residue split differs from / and %%\n");
+    }
+
+    // 4 x 2 with offset 0.5: 13 % 8 = 5 -> theta 1 (90 degrees), ring 1, R_efetivo 1.5
+    int points_ok = mapper_geometry_init(&geometry, 4, 2, 0.5f) == 0 &&
+                    map_to_cartesian_geometry(&geometry, "13", &theta, &ring, &x, &y) == 0 && theta == 1 &&
+                    ring == 1 && x == 0.0f && y == 1.5f &&
+                    map_to_cartesian_geometry(&geometry, "16", NULL, NULL, &x, &y) == 0 && x == 0.5f && y == 0.0f &&
+                    map_to_cartesian_geometry(&geometry, "1000000000000000000006", NULL, NULL, &x, &y) == 0 &&
+                    x == -1.5f && y == 0.0f &&
+                    map_to_cartesian_geometry(&geometry, "3", NULL, NULL, &x, &y) == 0 && x == 0.0f && y == -0.5f &&
+                    map_to_cartesian_geometry(&geometry, "1x", NULL, NULL, &x, &y) == -1;
+    mapper_geometry_free(&geometry);
+    total_tests++;
+    if (points_ok) {
+        printf("[PASS] Test: 4 x 2, offset 0.5 -> (0.5, 0), (0, 1.5), (-1.5, 0), (0, -0.5); \"1x\" -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: 4 x 2, offset 0.5 points are wrong\n");
+    }
+
+    // Streams and range streams in a 360 x 180 geometry match per-number mapping
+    const char* first = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
+    size_t count = 5000;
+    size_t len = build_consecutive_lines(first, count, lines);
+    int stream_ok = mapper_geometry_init(&geometry, 360, 180, -2.25f) == 0;
+    size_t expected_len = (size_t)snprintf(expected, sizeof(expected), "number,theta,ring,x,y\n");
+    char last[128] = "";
+    for (size_t start = 0; stream_ok && start < len;) {
+        size_t end = start;
+        while (lines[end] != '\n') end++;
+        memcpy(last, lines + start, end - start);
+        last[end - start] = '\0';
+        if (map_to_cartesian_geometry(&geometry, last, &theta, &ring, &x, &y) != 0) stream_ok = 0;
+        expected_len += (size_t)snprintf(expected + expected_len, sizeof(expected) - expected_len,
+                                         "%s,%d,%d,%.8f,%.8f\n", last, theta, ring, x, y);
+        start = end + 1;
+    }
+    for (int threads = 1; stream_ok && threads <= 4; ++threads) {
+        if (run_geometry_stream(&geometry, lines, len, NULL, NULL, threads, out_buf, sizeof(out_buf)) != 0 ||
+            strcmp(out_buf, expected) != 0) {
+            stream_ok = 0;
+        }
+    }
+    if (stream_ok && (run_geometry_stream(&geometry, "", 0, first, last, 3, out_buf, sizeof(out_buf)) != 0 ||
+                      strcmp(out_buf, expected) != 0)) {
+        stream_ok = 0;
+    }
+    mapper_geometry_free(&geometry);
+    total_tests++;
+    if (stream_ok) {
+        printf("[PASS] Test: 360 x 180 stream, buffer and range stream of %zu numbers -> same rows as per number\n",
+               count);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: 360 x 180 streams differ from per-number mapping\n");
+    }
+
+    total_tests++;
+    if (mapper_geometry_init(&geometry, 0, 77, 1.0f) == -1 && mapper_geometry_init(&geometry, 40, -1, 1.0f) == -1 &&
+        mapper_geometry_init(&geometry, 1024, 1025, 1.0f) == -1 &&
+        mapper_geometry_init(&geometry, 40, 77, NAN) == -1 &&
+        mapper_geometry_init(&geometry, 40, 77, 1e7f) == -1 && mapper_geometry_init(NULL, 40, 77, 1.0f) == -1 &&
+        map_to_cartesian_geometry(NULL, "1", NULL, NULL, &x, &y) == -1) {
+        printf("[PASS] Test: 0 angles, -1 rings, > 2^20 cells, NaN or huge offset, NULL -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Invalid geometry -> Expected Ret: -1\n");
+    }
+
+    printf("--- mapper_geometry tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Test map_to_cartesian_gross and its streams against the full quotient string
+static int test_gross_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char lines[1 << 20];
+    static char out_buf[1 << 22];
+    static char expected[1 << 22];
+    char quotient[128];
+
+    printf("--- Testing map_to_cartesian_gross ---\n");
+
+    const char* first = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
+    size_t count = 3000;
+    size_t len = build_consecutive_lines(first, count, lines);
+    len += (size_t)snprintf(lines + len, sizeof(lines) - len, "0\n39\n40\n1000\n1010\n");
+    int single_ok = 1;
+    size_t expected_len = (size_t)snprintf(expected, sizeof(expected), "number,theta,radius,log10_radius,x,y\n");
+    for (size_t start = 0; start < len;) {
+        size_t end = start;
+        while (lines[end] != '\n') end++;
+        char number[128];
+        memcpy(number, lines + start, end - start);
+        number[end - start] = '\0';
+        start = end + 1;
+
+        int theta = 0;
+        double radius = 0, log10_radius = 0, x = 0, y = 0;
+        calculate_large_div_to_string(number, 40, quotient, sizeof(quotient));
+        double want = strtod(quotient, NULL);
+        int want_theta = calculate_large_mod(number, 40);
+        if (map_to_cartesian_gross(number, &theta, &radius, &log10_radius, &x, &y) != 0 || theta != want_theta ||
+            radius != want || (want > 0 && fabs(log10_radius - log10(want)) > 1e-13) ||
+            x != (cos_table[theta] == 0.0f ? 0.0 : want * cos_table[theta] + 0.0) ||
+            y != (sin_table[theta] == 0.0f ? 0.0 : want * sin_table[theta] + 0.0)) {
+            single_ok = 0;
+        }
+        expected_len += (size_t)snprintf(expected + expected_len, sizeof(expected) - expected_len,
+                                         "%s,%d,%.17g,%.8f,%.17g,%.17g\n", number, theta, radius, log10_radius, x, y);
+    }
+    total_tests++;
+    if (single_ok) {
+        printf("[PASS] Test: %zu numbers -> radius = strtod(N / 40 string), x, y = radius * cos, sin\n", count + 5);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Gross radius differs from the full quotient\n");
+    }
+
+    int stream_ok = 1;
+    for (int threads = 1; threads <= 4; ++threads) {
+        FILE* in = tmpfile();
+        FILE* out = tmpfile();
+        if (!in || !out) {
+            stream_ok = 0;
+            break;
+        }
+        fwrite(lines, 1, len, in);
+        rewind(in);
+        int ret = threads % 2 == 0 ? map_to_cartesian_stream_gross(in, out, ',', threads)
+                                   : map_to_cartesian_buffer_gross(lines, len, out, ',', threads);
+        rewind(out);
+        size_t got = fread(out_buf, 1, sizeof(out_buf) - 1, out);
+        out_buf[got] = '\0';
+        fclose(in);
+        fclose(out);
+        if (ret != 0 || strcmp(out_buf, expected) != 0) stream_ok = 0;
+    }
+    total_tests++;
+    if (stream_ok) {
+        printf("[PASS] Test: Gross radius stream and buffer, 1-4 threads -> same rows as per number\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Gross radius stream rows differ\n");
+    }
+
+    int theta;
+    double radius, x, y;
+    total_tests++;
+    if (map_to_cartesian_gross("", &theta, &radius, NULL, &x, &y) == -1 &&
+        map_to_cartesian_gross("12a", &theta, &radius, NULL, &x, &y) == -1 &&
+        map_to_cartesian_gross(NULL, &theta, &radius, NULL, &x, &y) == -1 &&
+        map_to_cartesian_gross("12", &theta, NULL, NULL, &x, &y) == -1 &&
+        map_to_cartesian_gross("1234", &theta, &radius, NULL, &x, &y) == 0 && theta == 34 && radius == 30.0) {
+        printf("[PASS] Test: Empty, non-digit, NULL -> Ret: -1; \"1234\" without log10 -> theta 34, radius 30\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Invalid gross radius arguments -> Expected Ret: -1\n");
+    }
+
+    printf("--- map_to_cartesian_gross tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+// Counts diagnostic reports and remembers the last one
+struct diagnostic_log {
+    int count;
+    enum mapper_error error;
+    unsigned long long item;
+};
+
+static void log_diagnostic(void* context, enum mapper_error error, unsigned long long item) {
+    struct diagnostic_log* log = context;
+    log->count++;
+    log->error = error;
+    log->item = item;
+}
+
+struct core_thread_job {
+    const char* number;
+    struct mapper_cell cell;
+    enum mapper_error error;
+};
+
+static void* core_thread_main(void* arg) {
+    struct core_thread_job* job = arg;
+    job->error = mapper_core_map(MAPPER_INPUT_DECIMAL, job->number, strlen(job->number), &job->cell);
+    return NULL;
+}
+
+// Two handlers that each expect their own context, so a report that paired one
+// with the other's context is counted as mixed.
+struct swap_context {
+    char tag;
+    unsigned long long reports;
+};
+
+static unsigned long long swap_mixed;
+
+static void swap_diagnostic(struct swap_context* context, char expected) {
+    if (context->tag != expected) __atomic_add_fetch(&swap_mixed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&context->reports, 1, __ATOMIC_RELAXED);
+}
+
+static void swap_diagnostic_a(void* context, enum mapper_error error, unsigned long long item) {
+    (void)error;
+    (void)item;
+    swap_diagnostic(context, 'a');
+}
+
+static void swap_diagnostic_b(void* context, enum mapper_error error, unsigned long long item) {
+    (void)error;
+    (void)item;
+    swap_diagnostic(context, 'b');
+}
+
+#define SWAP_REPORTS_PER_THREAD 20000
+
+static void* swap_report_thread(void* arg) {
+    (void)arg;
+    float x, y;
+    for (int i = 0; i < SWAP_REPORTS_PER_THREAD; ++i) map_to_cartesian("12a", &x, &y);
+    return NULL;
+}
+
+// Test the reentrant core and the diagnostic handler
+static int test_core_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    struct mapper_cell cell;
+
+    printf("--- Testing mapper_core_map / mapper_set_diagnostic ---\n");
+
+    // The core agrees with map_to_cartesian, map_to_cartesian_hex and _bytes
+    const char* number = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
+    int r = spiral_residue(number);
+    unsigned char record[4] = {0x01, 0x02, 0x03, 0x04}; // 16909060 % 3080 = 2940: theta 20, ring 73
+    float x, y;
+    int same = mapper_core_map(MAPPER_INPUT_DECIMAL, number, strlen(number), &cell) == MAPPER_OK &&
+               map_to_cartesian(number, &x, &y) == 0 && cell.theta == r % 40 && cell.ring == r / 40 && cell.x == x &&
+               cell.y == y && mapper_core_map(MAPPER_INPUT_HEX, "0x1020304", 9, &cell) == MAPPER_OK &&
+               cell.theta == 20 && cell.ring == 73 &&
+               mapper_core_map(MAPPER_INPUT_BINARY, (const char*)record, sizeof(record), &cell) == MAPPER_OK &&
+               cell.theta == 20 && cell.ring == 73 && map_to_cartesian_bytes(record, sizeof(record), &x, &y) == 0 &&
+               cell.x == x && cell.y == y;
+    total_tests++;
+    if (same) {
+        printf("[PASS] Test: Decimal, hex and binary core cells -> same as map_to_cartesian(_hex, _bytes)\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Core cells differ from map_to_cartesian\n");
+    }
+
+    total_tests++;
+    if (mapper_core_map(MAPPER_INPUT_DECIMAL, NULL, 1, &cell) == MAPPER_ERROR_NULL_ARGUMENT &&
+        mapper_core_map(MAPPER_INPUT_DECIMAL, "1", 1, NULL) == MAPPER_ERROR_NULL_ARGUMENT &&
+        mapper_core_map(MAPPER_INPUT_DECIMAL, "", 0, &cell) == MAPPER_ERROR_EMPTY_NUMBER &&
+        mapper_core_map(MAPPER_INPUT_HEX, "0x", 2, &cell) == MAPPER_ERROR_EMPTY_NUMBER &&
+        mapper_core_map(MAPPER_INPUT_DECIMAL, "12a", 3, &cell) == MAPPER_ERROR_INVALID_DIGIT &&
+        mapper_core_map(MAPPER_INPUT_HEX, "0x1g", 4, &cell) == MAPPER_ERROR_INVALID_DIGIT &&
+        strcmp(mapper_error_string(MAPPER_ERROR_INVALID_DIGIT), "invalid digit") == 0 &&
+        strcmp(mapper_error_string((enum mapper_error)99), "unknown error") == 0) {
+        printf("[PASS] Test: NULL, empty, \"0x\", bad digits -> typed errors; error strings\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Core error codes are wrong\n");
+    }
+
+    // floor(N / 40) = 2^200 + 2^147 is halfway between two doubles: with 128-bit
+    // integers only this needs scratch
+    const char* tie = "64277521770359618157916947223445909392317966998787395325788199";
+    char scratch[64];
+    int theta;
+    double radius, gx, gy;
+    int gross_ok =
+        mapper_core_map_gross(tie, strlen(tie), NULL, 0, &theta, &radius, NULL, &gx, &gy) ==
+            MAPPER_ERROR_SCRATCH_TOO_SMALL &&
+        mapper_core_map_gross(tie, strlen(tie), scratch, sizeof(scratch), &theta, &radius, NULL, &gx, &gy) ==
+            MAPPER_OK &&
+        theta == 39 && radius == strtod("1606938044258990275541962092341162602522202993782792835301376", NULL) &&
+        mapper_core_map_gross("4x", 2, NULL, 0, &theta, &radius, NULL, &gx, &gy) == MAPPER_ERROR_INVALID_DIGIT;
+#if defined(__SIZEOF_INT128__)
+    if (mapper_core_map_gross(number, strlen(number), NULL, 0, &theta, &radius, NULL, &gx, &gy) != MAPPER_OK ||
+        theta != 30) {
+        gross_ok = 0;
+    }
+#endif
+    total_tests++;
+    if (gross_ok) {
+        printf("[PASS] Test: Gross core: halfway quotient -> needs scratch, then 2^200; others need none\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Gross core scratch handling\n");
+    }
+
+    // A 16 KiB stack is enough for the core
+    struct core_thread_job job = { number, { 0, 0, 0, 0 }, MAPPER_ERROR_NULL_ARGUMENT };
+    pthread_attr_t attr;
+    pthread_t thread;
+    int small_stack_ok = pthread_attr_init(&attr) == 0 && pthread_attr_setstacksize(&attr, 16384) == 0 &&
+                         pthread_create(&thread, &attr, core_thread_main, &job) == 0;
+    if (small_stack_ok) pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+    total_tests++;
+    if (small_stack_ok && job.error == MAPPER_OK && job.cell.theta == r % 40 && job.cell.ring == r / 40) {
+        printf("[PASS] Test: 76-digit number on a 16 KiB thread stack -> MAPPER_OK, same cell\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Core on a small stack\n");
+    }
+
+    // Reports go to the handler; NULL discards them
+    struct diagnostic_log log = { 0, MAPPER_OK, 0 };
+    mapper_set_diagnostic(log_diagnostic, &log);
+    int single_ok = map_to_cartesian("12a", &x, &y) == -1 && log.count == 1 &&
+                    log.error == MAPPER_ERROR_INVALID_DIGIT && log.item == 0 &&
+                    map_to_cartesian("", &x, &y) == -1 && log.error == MAPPER_ERROR_EMPTY_NUMBER;
+    // The other single-number forms report the same way
+    FILE* empty = tmpfile();
+    log.count = 0;
+    int forms_ok = map_to_cartesian_hex("0xfg", &x, &y) == -1 && log.error == MAPPER_ERROR_INVALID_DIGIT &&
+                   map_to_cartesian_bytes((const unsigned char*)"", 0, &x, &y) == -1 &&
+                   log.error == MAPPER_ERROR_EMPTY_NUMBER &&
+                   map_to_cartesian_geometry(NULL, "1", NULL, NULL, &x, &y) == -1 &&
+                   log.error == MAPPER_ERROR_NULL_ARGUMENT &&
+                   map_to_cartesian_gross("4x", &theta, &radius, NULL, &gx, &gy) == -1 &&
+                   log.error == MAPPER_ERROR_INVALID_DIGIT && empty && map_to_cartesian_file(empty, &x, &y) == -1 &&
+                   log.error == MAPPER_ERROR_EMPTY_NUMBER && log.count == 5 && log.item == 0;
+    if (empty) fclose(empty);
+    single_ok = single_ok && forms_ok;
+    const char lines[] = "12\nfoo\n34\n\n5x\n";
+    FILE* out = tmpfile();
+    log.count = 0;
+    int stream_ok = out && map_to_cartesian_buffer(lines, sizeof(lines) - 1, out, ',', 2) == 2 && log.count == 2 &&
+                    log.error == MAPPER_ERROR_INVALID_DIGIT && log.item == 5;
+    log.count = 0;
+    int binary_ok = out && map_to_cartesian_buffer_format((const char*)record, 3, out, ',', 1, MAPPER_INPUT_BINARY,
+                                                          4) == 1 &&
+                    log.count == 1 && log.error == MAPPER_ERROR_SHORT_RECORD && log.item == 1;
+    mapper_set_diagnostic(NULL, NULL);
+    log.count = 0;
+    int silent_ok = map_to_cartesian("12a", &x, &y) == -1 && out &&
+                    map_to_cartesian_buffer(lines, sizeof(lines) - 1, out, ',', 2) == 2 && log.count == 0;
+    mapper_set_diagnostic(mapper_diagnostic_stderr, NULL);
+    if (out) fclose(out);
+    total_tests++;
+    if (single_ok && stream_ok && binary_ok && silent_ok) {
+        printf("[PASS] Test: Handler gets item 0 for single numbers (all 6 forms), line 5 / record 1 for streams; "
+               "NULL -> none\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Diagnostic handler reports (single %d, stream %d, binary %d, silent %d)\n", single_ok,
+               stream_ok, binary_ok, silent_ok);
+    }
+
+    // Four threads report while the handler is swapped between a, b and NULL
+    struct swap_context context_a = { 'a', 0 }, context_b = { 'b', 0 };
+    pthread_t reporters[4];
+    int started = 0;
+    mapper_set_diagnostic(NULL, NULL);
+    for (int t = 0; t < 4; ++t) started += pthread_create(&reporters[t], NULL, swap_report_thread, NULL) == 0;
+    for (int swap = 0; swap < 300; ++swap) {
+        if (swap % 3 == 0) {
+            mapper_set_diagnostic(swap_diagnostic_a, &context_a);
+        } else if (swap % 3 == 1) {
+            mapper_set_diagnostic(swap_diagnostic_b, &context_b);
+        } else {
+            mapper_set_diagnostic(NULL, NULL);
+        }
+    }
+    mapper_set_diagnostic(swap_diagnostic_a, &context_a);
+    for (int t = 0; t < started; ++t) pthread_join(reporters[t], NULL);
+    unsigned long long before = context_a.reports;
+    map_to_cartesian("12a", &x, &y);
+    mapper_set_diagnostic(mapper_diagnostic_stderr, NULL);
+    total_tests++;
+    if (started == 4 && swap_mixed == 0 && context_a.reports == before + 1 &&
+        context_a.reports + context_b.reports <= 4ULL * SWAP_REPORTS_PER_THREAD + 1) {
+        printf("[PASS] Test: 4 threads reporting across 300 handler swaps -> no handler paired with another's context\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Handler swaps -> %llu mixed reports\n", swap_mixed);
+    }
+
+    printf("--- mapper core tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+static int stats_all_zero(const struct mapper_stats* stats) {
+    struct mapper_stats zero;
+    memset(&zero, 0, sizeof(zero));
+    zero.ticks_per_second = stats->ticks_per_second;
+    return memcmp(stats, &zero, sizeof(zero)) == 0;
+}
+
+static int test_stats_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    struct mapper_stats stats;
+
+    printf("--- Testing mapper_stats_get ---\n");
+
+    total_tests++;
+    if (strcmp(mapper_stage_name(MAPPER_STAGE_REDUCE), "reduce") == 0 &&
+        strcmp(mapper_stage_name(MAPPER_STAGE_COUNT), "unknown") == 0 && mapper_stats_get(NULL) == -1) {
+        printf("[PASS] Test: Stage names; NULL -> -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Stage names or NULL argument\n");
+    }
+
+#ifdef MAPPER_STATS
+    mapper_set_diagnostic(NULL, NULL);
+    mapper_stats_reset();
+    int reset_ok = mapper_stats_get(&stats) == 0 && stats_all_zero(&stats);
+
+    // The stream's workers have exited by the time it returns; their counts remain
+    const char lines[] = "12\nfoo\n34\n\n5x\n";
+    FILE* out = tmpfile();
+    int stream_ok = out && map_to_cartesian_buffer(lines, sizeof(lines) - 1, out, ',', 2) == 2 &&
+                    mapper_stats_get(&stats) == 0 && stats.numbers == 2 && stats.bytes == 4 &&
+                    stats.lengths[1] == 2 && stats.errors[MAPPER_ERROR_INVALID_DIGIT] == 2 &&
+                    stats.stage_ticks[MAPPER_STAGE_REDUCE] > 0 && stats.stage_ticks[MAPPER_STAGE_FORMAT] > 0 &&
+                    stats.wall_ns > 0 && stats.ticks_per_second > 0;
+    if (out) fclose(out);
+
+    // Single numbers, batches and the gross radius add to the same counts
+    const char* number = "9210836494447108270027136741376870869791784014198948301625976867708124077590";
+    const char* batch[3] = { "7", NULL, "" };
+    float x, y, xs[3], ys[3];
+    int status[3];
+    int theta;
+    double radius, x_gross, y_gross;
+    int calls_ok = map_to_cartesian(number, &x, &y) == 0 && map_to_cartesian_batch(batch, 3, xs, ys, status, 1) == 2 &&
+                   map_to_cartesian_gross("400", &theta, &radius, NULL, &x_gross, &y_gross) == 0 &&
+                   mapper_stats_get(&stats) == 0 && stats.numbers == 5 && stats.bytes == 4 + 76 + 1 + 3 &&
+                   stats.lengths[0] == 1 && stats.lengths[1] == 3 && stats.lengths[6] == 1 &&
+                   stats.errors[MAPPER_ERROR_NULL_ARGUMENT] == 1 && stats.errors[MAPPER_ERROR_EMPTY_NUMBER] == 1 &&
+                   stats.stage_ticks[MAPPER_STAGE_DIVIDE] > 0;
+
+    mapper_stats_reset();
+    int cleared_ok = mapper_stats_get(&stats) == 0 && stats_all_zero(&stats);
+    mapper_set_diagnostic(mapper_diagnostic_stderr, NULL);
+    total_tests++;
+    if (reset_ok && stream_ok && calls_ok && cleared_ok) {
+        printf("[PASS] Test: Numbers, bytes, lengths, failures by kind and stage ticks; reset -> 0\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Stats counts (reset %d, stream %d, calls %d, cleared %d)\n", reset_ok, stream_ok,
+               calls_ok, cleared_ok);
+    }
+#else
+    memset(&stats, 0xFF, sizeof(stats));
+    total_tests++;
+    if (mapper_stats_get(&stats) == -1 && stats_all_zero(&stats) && stats.ticks_per_second == 0) {
+        printf("[PASS] Test: Built without MAPPER_STATS -> -1, zeroed counts\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: mapper_stats_get without MAPPER_STATS\n");
+    }
+#endif
+
+    printf("--- mapper stats tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+struct serve_test_server {
+    int listen_fd;
+    int stop_fd;
+    int ret;
+};
+
+static void* serve_test_thread(void* arg) {
+    struct serve_test_server* server = arg;
+    server->ret = mapper_serve(server->listen_fd, server->stop_fd, 3, MAPPER_INPUT_DECIMAL);
+    return NULL;
+}
+
+static int serve_test_connect(const char* path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Reads until len bytes or end of stream; returns the bytes read.
+static size_t serve_test_read(int fd, unsigned char* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    return got;
+}
+
+// Checks a reply against mapper_core_map of the same number.
+static int serve_test_reply_ok(const unsigned char* reply, const char* digits, size_t len) {
+    struct mapper_cell cell;
+    enum mapper_error error = mapper_core_map(MAPPER_INPUT_DECIMAL, digits, len, &cell);
+    if (error != MAPPER_OK) memset(&cell, 0, sizeof(cell));
+    unsigned int x_bits, y_bits;
+    memcpy(&x_bits, &cell.x, sizeof(x_bits));
+    memcpy(&y_bits, &cell.y, sizeof(y_bits));
+    return load_le32(reply) == (unsigned int)error && load_le32(reply + 4) == (unsigned int)cell.theta &&
+           load_le32(reply + 8) == (unsigned int)cell.ring && load_le32(reply + 12) == x_bits &&
+           load_le32(reply + 16) == y_bits;
+}
+
+// Test mapper_serve over a Unix socket with two pipelining clients
+static int test_serve_function() {
+    int tests_passed = 0;
+    int total_tests = 0;
+    static char lines[1500 * 100];
+    static unsigned char frames[1500 * 104 + 16];
+    static unsigned char replies[1502 * MAPPER_SERVE_REPLY_BYTES];
+    static size_t line_start[1502], line_len[1502];
+
+    printf("--- Testing mapper_serve ---\n");
+
+    char dir[] = "/tmp/mapper-serve-XXXXXX";
+    char path[64];
+    int stop_pipe[2];
+    if (!mkdtemp(dir) || pipe(stop_pipe) == -1) {
+        printf("[FAIL] Test: Cannot create a temporary directory or pipe\n");
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/s.sock", dir);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, path);
+    struct serve_test_server server = { socket(AF_UNIX, SOCK_STREAM, 0), stop_pipe[0], -2 };
+    pthread_t thread;
+    int started = server.listen_fd != -1 && bind(server.listen_fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+                  listen(server.listen_fd, 16) == 0 &&
+                  pthread_create(&thread, NULL, serve_test_thread, &server) == 0;
+
+    // 1500 numbers, then an invalid and an empty one. The first connection sends
+    // them in one write, which makes batches large enough for the worker pool; the
+    // second sends them from number 700 on, in odd chunks that split frames.
+    size_t count = 1500;
+    build_consecutive_lines("9210836494447108270027136741376870869791784014198948301625976867708124077590",
+                                         count, lines);
+    size_t frames_len = 0, start = 0;
+    for (size_t i = 0; i < count + 2; ++i) {
+        if (i < count) {
+            line_start[i] = start;
+            while (lines[start] != '\n') start++;
+            line_len[i] = start - line_start[i];
+            start++;
+        } else {
+            line_start[i] = line_len[0] - 3; // "590\n" for the invalid one, then nothing
+            line_len[i] = i == count ? 4 : 0;
+        }
+        store_le32(frames + frames_len, (unsigned int)line_len[i]);
+        memcpy(frames + frames_len + 4, lines + line_start[i], line_len[i]);
+        frames_len += 4 + line_len[i];
+    }
+    size_t second_offset = 0;
+    for (size_t i = 0; i < 700; ++i) second_offset += 4 + line_len[i];
+
+    int first = started ? serve_test_connect(path) : -1;
+    int second = started ? serve_test_connect(path) : -1;
+    int sent_ok = first != -1 && second != -1 && write(first, frames, frames_len) == (ssize_t)frames_len;
+    for (size_t b = second_offset; sent_ok && b < frames_len;) {
+        size_t chunk = frames_len - b < 997 ? frames_len - b : 997;
+        sent_ok = write(second, frames + b, chunk) == (ssize_t)chunk;
+        b += chunk;
+    }
+    int first_ok = sent_ok && serve_test_read(first, replies, (count + 2) * MAPPER_SERVE_REPLY_BYTES) ==
+                                  (count + 2) * MAPPER_SERVE_REPLY_BYTES;
+    for (size_t i = 0; first_ok && i < count + 2; ++i) {
+        first_ok = serve_test_reply_ok(replies + i * MAPPER_SERVE_REPLY_BYTES, lines + line_start[i], line_len[i]);
+    }
+    first_ok = first_ok && load_le32(replies + count * MAPPER_SERVE_REPLY_BYTES) == MAPPER_ERROR_INVALID_DIGIT &&
+               load_le32(replies + (count + 1) * MAPPER_SERVE_REPLY_BYTES) == MAPPER_ERROR_EMPTY_NUMBER;
+    int second_ok = sent_ok && serve_test_read(second, replies, (count + 2 - 700) * MAPPER_SERVE_REPLY_BYTES) ==
+                                   (count + 2 - 700) * MAPPER_SERVE_REPLY_BYTES;
+    for (size_t i = 700; second_ok && i < count + 2; ++i) {
+        second_ok = serve_test_reply_ok(replies + (i - 700) * MAPPER_SERVE_REPLY_BYTES, lines + line_start[i],
+                                        line_len[i]);
+    }
+    total_tests++;
+    if (first_ok && second_ok) {
+        printf("[PASS] Test: 2 connections, %zu pipelined frames -> replies in order, as mapper_core_map\n",
+               count + 2);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Pipelined frames -> first connection %s, second %s\n", first_ok ? "ok" : "wrong",
+               second_ok ? "ok" : "wrong");
+    }
+
+    // A frame over MAPPER_SERVE_MAX_NUMBER closes its connection, not the others
+    unsigned char oversized[4];
+    store_le32(oversized, MAPPER_SERVE_MAX_NUMBER + 1);
+    int closed_ok = first != -1 && write(first, oversized, sizeof(oversized)) == (ssize_t)sizeof(oversized) &&
+                    serve_test_read(first, replies, 1) == 0;
+    store_le32(frames, 2);
+    memcpy(frames + 4, "77", 2);
+    closed_ok = closed_ok && second != -1 && write(second, frames, 6) == 6 &&
+                serve_test_read(second, replies, MAPPER_SERVE_REPLY_BYTES) == MAPPER_SERVE_REPLY_BYTES &&
+                serve_test_reply_ok(replies, "77", 2);
+    total_tests++;
+    if (closed_ok) {
+        printf("[PASS] Test: Frame of %d bytes -> its connection closed, the other still served\n",
+               MAPPER_SERVE_MAX_NUMBER + 1);
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Oversized frame handling\n");
+    }
+    if (first != -1) close(first);
+    if (second != -1) close(second);
+
+    int stopped = started && write(stop_pipe[1], "", 1) == 1 && pthread_join(thread, NULL) == 0 && server.ret == 0;
+    total_tests++;
+    if (stopped && mapper_serve(-1, stop_pipe[0], 1, MAPPER_INPUT_DECIMAL) == -1 &&
+        mapper_serve(server.listen_fd, -1, 1, MAPPER_INPUT_DECIMAL) == -1) {
+        printf("[PASS] Test: Stop pipe -> Ret: 0; bad descriptors -> Ret: -1\n");
+        tests_passed++;
+    } else {
+        printf("[FAIL] Test: Stopping -> Got %d\n", server.ret);
+    }
+    if (server.listen_fd != -1) close(server.listen_fd);
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    unlink(path);
+    rmdir(dir);
+
+    printf("--- mapper_serve tests finished: %d/%d passed ---\n\n", tests_passed, total_tests);
+    return (tests_passed == total_tests);
+}
+
+int main() {
+    printf("=== Running Mapper Tests ===\n");
+    int map_ok = test_map_function();
+    int batch_ok = test_batch_function();
+    int stream_ok = test_stream_function();
+    int range_ok = test_range_function();
+    int file_ok = test_file_function();
+    int hex_ok = test_hex_binary_function();
+    int histogram_ok = test_histogram_function();
+    int render_ok = test_render_function();
+    int index_ok = test_index_function();
+    int range_counts_ok = test_range_counts_function();
+    int geometry_ok = test_geometry_function();
+    int gross_ok = test_gross_function();
+    int core_ok = test_core_function();
+    int stats_ok = test_stats_function();
+    int serve_ok = test_serve_function();
+
+    if (map_ok && batch_ok && stream_ok && range_ok && file_ok && hex_ok && histogram_ok && render_ok && index_ok &&
+        range_counts_ok && geometry_ok && gross_ok && core_ok && stats_ok && serve_ok) {
+        printf("=== All Mapper Tests Passed ===\n");
+        return 0;
+    } else {
+        printf("=== SOME MAPPER TESTS FAILED ===\n");
+        return 1;
+    }
 }
+#endif // TEST_MAPPER
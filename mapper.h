@@ -0,0 +1,416 @@
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include <stddef.h> // For size_t
+#include <stdio.h>  // For FILE
+
+#include "large_int_arithmetic.h" // For struct large_divisor
+
+// Build mapper.c with -DMAPPER_NO_MAIN to link these functions into another program.
+
+// Number of spiral cells (40 angles x 77 rings); cell index = theta + 40 * ring.
+#define MAPPER_CELL_COUNT 3080
+
+// Maps a decimal number string to Cartesian coordinates on the 40 x 77 spiral.
+// Returns 0 on success.
+// Returns -1 (and reports it through the diagnostic handler, see
+// mapper_set_diagnostic) if any pointer is NULL, or if number_str is empty or
+// contains non-digits.
+int map_to_cartesian(const char* number_str, float *x_out, float *y_out);
+
+// Same as map_to_cartesian for a hexadecimal number string (optional "0x" prefix,
+// either case), or for a big-endian unsigned binary number of len bytes. These
+// reduce 64 bits at a time with no decimal conversion and give the same
+// coordinates as map_to_cartesian does for the same value.
+// Returns 0 on success, or -1 (reported as for map_to_cartesian) if a pointer is
+// NULL or the input is empty or contains a non-hex character.
+int map_to_cartesian_hex(const char* hex_str, float* x_out, float* y_out);
+
+int map_to_cartesian_bytes(const unsigned char* bytes, size_t len, float* x_out, float* y_out);
+
+// Maps the single decimal number read from in, which may be arbitrarily long: it is
+// read and reduced in fixed-size blocks, so memory use does not depend on its
+// length. One trailing "\n" or "\r\n" is allowed.
+// Returns 0 on success, or -1 (reported as for map_to_cartesian) if a pointer is
+// NULL, on a read error, or if the input is empty or contains any other non-digit.
+int map_to_cartesian_file(FILE* in, float* x_out, float* y_out);
+
+// Spiral geometry. A number N lands on theta_index = N % angular_divisions and
+// indice_circunferencia = (N / angular_divisions) % ring_count, at
+// R_efetivo = indice_circunferencia + radius_offset along the angle
+// 2 * pi * theta_index / angular_divisions. Every function without "geometry" in
+// its name uses the built-in 40 x 77 spiral with radius_offset 1, whose divisors
+// are compile-time constants. A geometry set up with mapper_geometry_init gets its
+// point table generated and its divisors' reciprocals computed once, so mapping
+// with it divides by multiplying as well. Fields other than the first three are
+// internal to mapper.c.
+#define MAPPER_GEOMETRY_MAX_CELLS (1 << 20)
+
+struct mapper_point {
+    float x;
+    float y;
+};
+
+struct mapper_geometry {
+    int angular_divisions;
+    int ring_count;
+    float radius_offset;
+    int cell_count; // angular_divisions * ring_count, the period of the mapping
+    const struct mapper_point* points; // Indexed by N % cell_count
+    struct large_divisor cell_divisor;
+    unsigned long long angle_reciprocal; // floor(2^40 / angular_divisions) + 1
+    struct mapper_point* owned_points; // NULL when points is the built-in table
+};
+
+// Sets up geometry for the given spiral. 40, 77, 1.0 gives the built-in geometry,
+// with bit-identical coordinates to map_to_cartesian.
+// Returns 0, or -1 if geometry is NULL, a count is < 1, their product exceeds
+// MAPPER_GEOMETRY_MAX_CELLS, |radius_offset| exceeds MAPPER_GEOMETRY_MAX_CELLS (or is
+// NaN), or on allocation failure. Release with mapper_geometry_free.
+int mapper_geometry_init(struct mapper_geometry* geometry, int angular_divisions, int ring_count,
+                         float radius_offset);
+
+void mapper_geometry_free(struct mapper_geometry* geometry);
+
+// map_to_cartesian for a geometry. theta_out and ring_out may be NULL; otherwise they
+// receive theta_index and indice_circunferencia.
+// Returns 0 on success, or -1 (reported as for map_to_cartesian) if geometry,
+// number_str, x_out or y_out is NULL, or if number_str is empty or contains
+// non-digits.
+int map_to_cartesian_geometry(const struct mapper_geometry* geometry, const char* number_str,
+                              int* theta_out, int* ring_out, float* x_out, float* y_out);
+
+// Maps a decimal number string by the original scheme, which scales by the gross
+// radius N / 40 itself rather than by R_efetivo: *radius_out is floor(N / 40) as
+// the nearest double (HUGE_VAL past DBL_MAX), *log10_out its base-10 logarithm
+// (finite for any N >= 40; log10_out may be NULL), and *x_out, *y_out are
+// radius * cos_table[theta_index] and radius * sin_table[theta_index]. Only the
+// leading and last few digits are used arithmetically, so the cost does not grow
+// with the quotient.
+// Returns 0 on success, or -1 (reported as for map_to_cartesian) if a required
+// pointer is NULL, or if number_str is empty or contains non-digits.
+int map_to_cartesian_gross(const char* number_str, int* theta_out, double* radius_out, double* log10_out,
+                           double* x_out, double* y_out);
+
+// Maps count number strings in one call. Results are written structure-of-arrays
+// style: x_out[i], y_out[i] and status_out[i] belong to number_strs[i].
+// status_out[i] is 0 on success or -1 if number_strs[i] is NULL, empty or contains
+// non-digits; x_out[i]/y_out[i] are set to 0 for failed entries.
+// The work is split across num_threads worker threads (<= 0 uses one per online CPU).
+// Nothing is printed.
+// Returns the number of entries that failed to map (clamped to INT_MAX; status_out
+// has the exact failures), or -1 if an input or output array is NULL. A slice
+// whose thread cannot be started is mapped by the caller.
+int map_to_cartesian_batch(
+    const char* const* number_strs,
+    size_t count,
+    float* x_out,
+    float* y_out,
+    int* status_out,
+    int num_threads
+);
+
+// Same as map_to_cartesian_batch, for numbers stored back to back in one buffer.
+// Number i is buffer[offsets[i]] .. buffer[offsets[i + 1] - 1], so offsets holds
+// count + 1 entries and the numbers need not be NUL-terminated.
+int map_to_cartesian_batch_concat(
+    const char* buffer,
+    const size_t* offsets,
+    size_t count,
+    float* x_out,
+    float* y_out,
+    int* status_out,
+    int num_threads
+);
+
+// Maps the count consecutive integers first_str, first_str + 1, ... into x_out[]
+// and y_out[]. first_str is parsed once; each following value is one residue step
+// from the previous, so no further parsing happens. Slices of the range are split
+// across num_threads threads (<= 0 uses one per online CPU).
+// Returns 0 on success, or -1 if a pointer is NULL or first_str is empty or
+// contains non-digits.
+int map_to_cartesian_range(const char* first_str, size_t count, float* x_out, float* y_out, int num_threads);
+
+// Reads newline-delimited numbers from in and writes one row per number to out:
+// a header line, then "number,theta,ring,x,y" with separator in place of ','.
+// Rows keep the input order. Blank lines are skipped; invalid lines are reported
+// to the diagnostic handler by line number and left out. Input is cut into batches mapped by
+// num_threads worker threads (<= 0 uses one per online CPU), and memory use is
+// bounded by a fixed number of batches in flight.
+// Returns the number of invalid lines, or -1 on a read, write or allocation failure.
+int map_to_cartesian_stream(FILE* in, FILE* out, char separator, int num_threads);
+
+// Same as map_to_cartesian_stream for newline-delimited numbers already in memory,
+// such as a memory-mapped file. Lines are mapped in place: data is never copied and
+// need not be NUL-terminated.
+int map_to_cartesian_buffer(const char* data, size_t len, FILE* out, char separator, int num_threads);
+
+// How the streaming functions read their input.
+enum mapper_input_format {
+    MAPPER_INPUT_DECIMAL, // Decimal number lines
+    MAPPER_INPUT_HEX,     // Hexadecimal number lines, as map_to_cartesian_hex
+    MAPPER_INPUT_BINARY   // Back-to-back big-endian records of record_size bytes
+};
+
+// Reentrant core. These functions allocate nothing, start no threads, do no I/O,
+// take no locks and touch no global state; their stack use is small and fixed, so
+// they can run on minimal worker-thread stacks and in tight loops. Failures come
+// back as a mapper_error, never as output.
+enum mapper_error {
+    MAPPER_OK = 0,
+    MAPPER_ERROR_NULL_ARGUMENT,     // A required pointer is NULL
+    MAPPER_ERROR_EMPTY_NUMBER,      // No digits
+    MAPPER_ERROR_INVALID_DIGIT,     // A character that is not a digit of the input format
+    MAPPER_ERROR_SHORT_RECORD,      // A binary record shorter than the record size
+    MAPPER_ERROR_SCRATCH_TOO_SMALL, // mapper_core_map_gross needed more scratch space
+    MAPPER_ERROR_READ,              // map_to_cartesian_file could not read its input
+};
+
+// A short English description of error, e.g. "invalid digit"; never NULL.
+const char* mapper_error_string(enum mapper_error error);
+
+// One number's place on the built-in 40 x 77 spiral.
+struct mapper_cell {
+    int theta; // theta_index
+    int ring;  // indice_circunferencia
+    float x;
+    float y;
+};
+
+// Maps the number in data[0..len): decimal or hex digits (as map_to_cartesian and
+// map_to_cartesian_hex), or for MAPPER_INPUT_BINARY a big-endian record of len
+// bytes. Long numbers are reduced serially here; map_to_cartesian splits them
+// across threads instead.
+enum mapper_error mapper_core_map(enum mapper_input_format format, const char* data, size_t len,
+                                  struct mapper_cell* cell_out);
+
+// map_to_cartesian_gross for the decimal digits[0..len). In the rare case where the
+// leading digits cannot settle the rounding of the radius, the exact quotient is
+// built in scratch: MAPPER_ERROR_SCRATCH_TOO_SMALL is returned if it then holds
+// fewer than len + 1 bytes (passing len + 1 bytes, or more, always succeeds).
+// log10_out may be NULL.
+enum mapper_error mapper_core_map_gross(const char* digits, size_t len, char* scratch, size_t scratch_size,
+                                        int* theta_out, double* radius_out, double* log10_out, double* x_out,
+                                        double* y_out);
+
+// Diagnostics. The convenience functions built on the core report each failure to
+// one process-wide handler. Those that map one number (map_to_cartesian and its
+// _hex, _bytes, _file, _geometry and _gross forms) report with item 0; the
+// streaming, histogram and index functions report each bad line or record with
+// its 1-based number. The exceptions: the batch functions report nothing, as
+// status_out already holds each entry's failure, and the range, render and serve
+// functions only return their argument errors (mapper_serve answers bad numbers
+// in their replies). The default handler writes a line to stderr;
+// mapper_set_diagnostic(NULL, NULL) discards reports, so malformed input takes no
+// lock at all. The handler may be changed at any time: a report goes to the
+// handler and context of one mapper_set_diagnostic call, the old one or the new,
+// never a mix. It is called from the thread that hits (or, for streams, writes
+// out) the failure, and may still be running when mapper_set_diagnostic returns.
+// Each call keeps a few bytes allocated until exit (if that allocation fails, the
+// previous handler stays), so the handler is meant to change rarely.
+typedef void (*mapper_diagnostic_fn)(void* context, enum mapper_error error, unsigned long long item);
+
+void mapper_set_diagnostic(mapper_diagnostic_fn handler, void* context);
+
+// Writes the default handler's line for a report to stderr; context is unused.
+void mapper_diagnostic_stderr(void* context, enum mapper_error error, unsigned long long item);
+
+// Instrumentation. When mapper.c is built with -DMAPPER_STATS, the convenience
+// functions count where their time goes, per stage, along with the numbers they
+// map and the failures they hit; each thread counts into its own block, so
+// counting takes no lock. Without it nothing is counted and mapper_stats_get
+// returns -1. Stage times are summed over all threads, in ticks of the CPU
+// time-stamp counter where there is one (nanoseconds elsewhere).
+enum mapper_stage {
+    MAPPER_STAGE_READ,   // Reading the input, or cutting a mapping or range into batches
+    MAPPER_STAGE_SPLIT,  // Finding the lines or records of a batch
+    MAPPER_STAGE_REDUCE, // Validating and reducing numbers to a residue, in one pass
+    MAPPER_STAGE_DIVIDE, // Gross radius mode: dividing by 40 and scaling the point
+    MAPPER_STAGE_FORMAT, // Looking up points and formatting rows
+    MAPPER_STAGE_WRITE,  // Writing rows out and reporting failures
+    MAPPER_STAGE_COUNT
+};
+
+#define MAPPER_ERROR_KINDS (MAPPER_ERROR_READ + 1)
+#define MAPPER_STATS_LENGTH_BUCKETS 32
+
+struct mapper_stats {
+    unsigned long long stage_ticks[MAPPER_STAGE_COUNT];
+    unsigned long long numbers; // Mapped successfully
+    unsigned long long bytes;   // Digits (or record bytes) of those numbers
+    // lengths[b]: numbers of 2^b to 2^(b+1) - 1 bytes; the last bucket also takes longer ones
+    unsigned long long lengths[MAPPER_STATS_LENGTH_BUCKETS];
+    unsigned long long errors[MAPPER_ERROR_KINDS]; // Failures by mapper_error
+    unsigned long long wall_ns; // Wall-clock time spent in the stream, buffer, histogram and batch calls
+    double ticks_per_second;    // Rate of stage_ticks, measured since the last reset
+};
+
+// The lowercase name of stage, e.g. "reduce"; never NULL.
+const char* mapper_stage_name(enum mapper_stage stage);
+
+// Fills *stats_out with the counts of all threads since the start (or the last
+// mapper_stats_reset), including threads that have since exited. It may be called
+// while mapping runs; counts still being added may be missing.
+// Returns 0, or -1 (with *stats_out zeroed) on a NULL pointer or without MAPPER_STATS.
+int mapper_stats_get(struct mapper_stats* stats_out);
+
+// Zeroes the counts. Call it while nothing is being mapped.
+void mapper_stats_reset(void);
+
+// map_to_cartesian_stream and map_to_cartesian_buffer for any input format.
+// record_size is used only for MAPPER_INPUT_BINARY, where it must be non-zero;
+// the number column then holds each record's lowercase hex digits, and a short
+// final record counts as invalid.
+int map_to_cartesian_stream_format(FILE* in, FILE* out, char separator, int num_threads,
+                                   enum mapper_input_format format, size_t record_size);
+
+int map_to_cartesian_buffer_format(const char* data, size_t len, FILE* out, char separator, int num_threads,
+                                   enum mapper_input_format format, size_t record_size);
+
+// map_to_cartesian_stream_format, map_to_cartesian_buffer_format and
+// map_to_cartesian_range_stream for a geometry (NULL means the built-in one).
+int map_to_cartesian_stream_geometry(const struct mapper_geometry* geometry, FILE* in, FILE* out, char separator,
+                                     int num_threads, enum mapper_input_format format, size_t record_size);
+
+int map_to_cartesian_buffer_geometry(const struct mapper_geometry* geometry, const char* data, size_t len,
+                                     FILE* out, char separator, int num_threads,
+                                     enum mapper_input_format format, size_t record_size);
+
+int map_to_cartesian_range_stream_geometry(const struct mapper_geometry* geometry, const char* first_str,
+                                           const char* last_str, FILE* out, char separator, int num_threads);
+
+// map_to_cartesian_stream and map_to_cartesian_buffer with map_to_cartesian_gross:
+// the rows are "number,theta,radius,log10_radius,x,y", with radius, x and y printed
+// to 17 significant digits. Input lines are decimal.
+int map_to_cartesian_stream_gross(FILE* in, FILE* out, char separator, int num_threads);
+
+int map_to_cartesian_buffer_gross(const char* data, size_t len, FILE* out, char separator, int num_threads);
+
+// Counts how many input numbers fall in each cell instead of writing rows:
+// counts_out[theta + 40 * ring] is overwritten with the hits for that cell. Input is
+// read as for map_to_cartesian_stream_format; each worker thread counts into its own
+// table and the tables are summed at the end. Invalid lines are still reported to
+// the diagnostic handler and not counted.
+// Returns the number of invalid lines, or -1 on a NULL pointer, a read or an
+// allocation failure.
+int map_to_cartesian_histogram(FILE* in, unsigned long long counts_out[MAPPER_CELL_COUNT], int num_threads,
+                               enum mapper_input_format format, size_t record_size);
+
+int map_to_cartesian_histogram_buffer(const char* data, size_t len, unsigned long long counts_out[MAPPER_CELL_COUNT],
+                                      int num_threads, enum mapper_input_format format, size_t record_size);
+
+// The histogram functions for a geometry (NULL means the built-in one):
+// counts_out has geometry->cell_count entries, indexed by residue.
+int map_to_cartesian_histogram_geometry(const struct mapper_geometry* geometry, FILE* in,
+                                        unsigned long long* counts_out, int num_threads,
+                                        enum mapper_input_format format, size_t record_size);
+
+int map_to_cartesian_histogram_buffer_geometry(const struct mapper_geometry* geometry, const char* data, size_t len,
+                                               unsigned long long* counts_out, int num_threads,
+                                               enum mapper_input_format format, size_t record_size);
+
+// Density images of cell counts. PGM is 8-bit grey (binary P5); PPM is binary P6
+// through a black, red, yellow, white ramp.
+#define MAPPER_RENDER_MAX_SIDE 32768
+
+enum mapper_image_format {
+    MAPPER_IMAGE_PGM,
+    MAPPER_IMAGE_PPM
+};
+
+// Writes counts (one per cell of geometry, NULL for the built-in one, as filled by
+// the histogram functions) to out as a width x height image. Each cell's hits land
+// on the pixel under its (x, y) point, scaled so the outermost ring fits the
+// shorter side whatever the counts, so successive images line up. A pixel's level
+// is 1 + 254 * log(1 + hits) / log(1 + hits of the densest pixel): a single hit
+// stays visible, and input spread evenly renders at full brightness. Pixels
+// without hits are black. Time and memory grow with the cell count
+// and width, not with how many numbers were counted.
+// Returns 0, or -1 on a NULL pointer, a side outside 1 .. MAPPER_RENDER_MAX_SIDE,
+// or a write or allocation failure.
+int mapper_render_density(const struct mapper_geometry* geometry, const unsigned long long* counts, int width,
+                          int height, enum mapper_image_format format, FILE* out);
+
+// Builds a cell index of the newline-delimited numbers (or binary records) in
+// data[0..len) and writes it to index_path, so that the keys of one cell can later
+// be read without scanning the corpus. Keys are partitioned by cell in two passes
+// over slices of data, one per thread (num_threads <= 0 uses one per online CPU):
+// the first computes each key's cell and the bytes every slice adds to every cell,
+// the second copies the keys straight to their final place in the mapped file.
+// Blank lines are skipped; invalid lines are reported to the diagnostic handler and
+// left out.
+// Returns the number of invalid lines, or -1 on a NULL pointer, a zero
+// record_size for MAPPER_INPUT_BINARY, or an allocation or file failure.
+int mapper_index_build(const char* data, size_t len, const char* index_path, int num_threads,
+                       enum mapper_input_format format, size_t record_size);
+
+// A cell index opened for queries; the file stays memory-mapped until closed.
+struct mapper_index {
+    const char* data;
+    size_t size;
+    size_t record_size; // 0 if keys are text lines, else bytes per binary key
+};
+
+// Maps index_path and checks its header and offset table.
+// Returns 0 on success, or -1 if it cannot be mapped or is not a valid index.
+int mapper_index_open(const char* index_path, struct mapper_index* index);
+
+// Points *keys_out at the keys of cell (theta, ring) and sets *len_out to their
+// total length in bytes, in O(1). Text keys are each followed by '\n', in input
+// order; binary keys are index->record_size bytes each. The keys live in the
+// mapping and stay valid until mapper_index_close.
+// Returns 0 on success, or -1 on a NULL pointer or a cell outside 40 x 77.
+int mapper_index_cell(const struct mapper_index* index, int theta, int ring, const char** keys_out, size_t* len_out);
+
+void mapper_index_close(struct mapper_index* index);
+
+// Writes the rows map_to_cartesian_stream would produce for the integers
+// first_str .. last_str (inclusive), without reading them from anywhere. The range
+// is cut into blocks mapped by num_threads threads; each block jumps to its first
+// value with a big-number add and then increments the decimal digits in place.
+// Returns 0 on success, or -1 if first_str/last_str are not decimal numbers with
+// first <= last and last - first < 2^64, or on a write or allocation failure.
+int map_to_cartesian_range_stream(const char* first_str, const char* last_str, FILE* out,
+                                  char separator, int num_threads);
+
+// Counts how many integers in first_str .. last_str (inclusive, decimal, any size)
+// land in each cell, from the bounds alone: the work grows with the number of
+// digits, not with last - first. Every cell gets base or base + 1 hits; base is
+// written to base_out in decimal and extra_out[theta + 40 * ring] is set to 1 for
+// the cells that get one more (0 for the rest).
+// Returns 0 on success, or -1 on a NULL pointer, if the bounds are not decimal
+// numbers with first <= last, or if base_size is too small for base
+// (strlen(last_str) + 1 is always enough).
+int map_to_cartesian_range_counts(const char* first_str, const char* last_str, char* base_out, size_t base_size,
+                                  unsigned char extra_out[MAPPER_CELL_COUNT]);
+
+// Writes to key_out, in decimal, the k-th (counting from 0) integer of
+// first_str .. last_str that lands in cell (theta, ring), computed directly
+// rather than by stepping through the range.
+// Returns 0 on success, or -1 on a NULL pointer, a cell outside 40 x 77, bounds
+// that are not decimal numbers, if the cell has k or fewer integers in the range,
+// or if key_size is too small (strlen(last_str) + 1 is always enough).
+int map_to_cartesian_range_key(const char* first_str, const char* last_str, int theta, int ring,
+                               unsigned long long k, char* key_out, size_t key_size);
+
+// Mapping service. Each request is a frame: a 4-byte little-endian length, then
+// that many bytes holding one number in the server's input format (for
+// MAPPER_INPUT_BINARY, the whole frame is one big-endian record). Each reply is
+// MAPPER_SERVE_REPLY_BYTES bytes, little-endian, in request order per connection:
+// int32 status (a mapper_error, MAPPER_OK on success), int32 theta_index, int32
+// indice_circunferencia, float x, float y; the last four are 0 on failure. A frame
+// longer than MAPPER_SERVE_MAX_NUMBER bytes closes its connection.
+#define MAPPER_SERVE_REPLY_BYTES 20
+#define MAPPER_SERVE_MAX_NUMBER (1 << 20)
+
+// Serves requests on listen_fd, a listening stream socket (Unix or TCP), until
+// stop_fd (such as the read end of a pipe) becomes readable. One thread runs an
+// epoll loop over all connections; the frames read in one wakeup, from however
+// many connections, form a batch. Large batches are mapped by a pool of
+// num_threads threads (<= 0 uses one per online CPU) started once, small ones on
+// the loop thread, which saves the wakeups. A failed number only sets its reply's
+// status; nothing goes to the diagnostic handler.
+// Returns 0 once stopped, or -1 on a bad descriptor or if epoll cannot be set up.
+int mapper_serve(int listen_fd, int stop_fd, int num_threads, enum mapper_input_format format);
+
+#endif // MAPPER_H